@@ -0,0 +1,28 @@
+#include "arena.hpp"
+#include <algorithm>
+
+namespace lox::arena{
+    void* Arena::allocate(size_t size, size_t alignment){
+        void* ptr = cursor;
+        size_t space = end - cursor;
+        if (cursor == nullptr || std::align(alignment, size, ptr, space) == nullptr){
+            // Nodes bigger than a block get a block of their own.
+            size_t block_size = std::max(BLOCK_SIZE, size + alignment);
+            blocks.push_back(std::make_unique_for_overwrite<byte[]>(block_size));
+            cursor = blocks.back().get();
+            end = cursor + block_size;
+            ptr = cursor;
+            space = block_size;
+            std::align(alignment, size, ptr, space);
+        }
+        cursor = static_cast<byte*>(ptr) + size;
+        return ptr;
+    }
+
+    // Destroys nodes in reverse order of creation, like the members of an object.
+    Arena::~Arena(){
+        for (auto it = destructors.rbegin(); it != destructors.rend(); ++it){
+            it->destroy(it->obj);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace lox::arena{
+    using std::byte;
+    using std::unique_ptr;
+    using std::vector;
+
+    // Bump allocator owning every node of a syntax tree.
+    // Nodes are laid out next to each other in large blocks and handed out as plain pointers,
+    // which stay valid until the arena itself is destroyed. Everything is then freed at once.
+    class Arena{
+        // Runs the destructor of a node which owns memory of its own (strings, vectors...).
+        struct Destructor{
+            void (*destroy)(void*);
+            void* obj;
+        };
+
+        static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+        vector<unique_ptr<byte[]>> blocks;
+        vector<Destructor> destructors;
+        byte* cursor = nullptr;
+        byte* end = nullptr;
+
+        void* allocate(size_t size, size_t alignment);
+
+        public:
+            Arena() = default;
+            Arena(const Arena&) = delete;
+            Arena& operator=(const Arena&) = delete;
+            ~Arena();
+
+            template<class T, class... Args> T* make(Args&&... args){
+                void* mem = allocate(sizeof(T), alignof(T));
+                T* obj = new (mem) T(std::forward<Args>(args)...);
+                if constexpr (!std::is_trivially_destructible_v<T>){
+                    destructors.push_back({[](void* ptr){ static_cast<T*>(ptr)->~T(); }, obj});
+                }
+                return obj;
+            }
+    };
+}
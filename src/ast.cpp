@@ -3,18 +3,41 @@
 //
 
 #include "ast.hpp"
+#include "gc.hpp"
 
 namespace lox::ast{
     bool is_truthy(EvalResult eval_result){  // Truth operator check.
-        if (is_string(eval_result)){
-            return as_string(eval_result) != "nil";
+        if (eval_result.is_nil()){
+            return false;
         }
-        else if (holds_alternative<bool>(eval_result)){
+        else if (is_boolean(eval_result)){
             return as_bool(eval_result);
         }
         return true;
     }
 
+    void print_value(const EvalResult& result){
+        if (result.is_nil()){
+            cout << "nil" << '\n';
+        }
+        else if (is_boolean(result)){
+            cout << (as_bool(result) ? "true" : "false") << '\n';
+        }
+        else if (is_number(result)){
+            lox::numbers::NumberBuffer buffer;
+            cout << lox::numbers::format_number(as_double(result), buffer) << '\n';
+        }
+        else if (is_callable(result)){
+            cout << as_func(result)->to_string() << '\n';
+        }
+        else if (is_cls_inst(result)){
+            cout << as_cls_inst(result)->to_string() << '\n';
+        }
+        else{
+            cout << as_string(result) << '\n';
+        }
+    }
+
     // region AST constants
     const unordered_map<TokenType, LiteralExprType> _TOKEN_TO_LITEXPRTP{
             {TokenType::TRUE, LiteralExprType::TRUE},
@@ -79,23 +102,23 @@ namespace lox::ast{
         }
     }
 
-    EvalResult LiteralExpr::evaluate(const shared_ptr<Environment>& env){
-        switch (expr_type){
+    LiteralExpr::LiteralExpr(LiteralExprType type): Expr(ExprKind::LITERAL), expr_type(type){
+        switch (type){
             case LiteralExprType::TRUE:
-                return true;
+                decoded = true;
+                break;
             case LiteralExprType::FALSE:
-                return false;
+                decoded = false;
+                break;
             case LiteralExprType::NIL:
-                return "nil";
-            case LiteralExprType::NUMBER:
-                return stod(value);
+                break;
             default:
-                return value;
+                throw invalid_argument("Numbers and strings need a value to build a literal expression.");
         }
     }
 
-    EvalResult LiteralExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
-        return evaluate(get_current_env(interpreter));
+    EvalResult LiteralExpr::evaluate(Interpreter&){
+        return decoded;
     }
     // endregion
 
@@ -106,101 +129,129 @@ namespace lox::ast{
     // endregion
 
     // region BinaryExpr
-    EvalResult BinaryExpr::evaluate(const shared_ptr<Environment>& env){
-        using enum Operator;
-        EvalResult left_result = left->evaluate(env), right_result = right->evaluate(env);
-        bool two_numbers = holds_alternative<double>(left_result) && holds_alternative<double>(right_result);
-        bool two_bools = holds_alternative<bool>(left_result) && holds_alternative<bool>(right_result);
-        bool two_strings = holds_alternative<string>(left_result) && holds_alternative<string>(right_result);
-
-        switch (op){
-            case PLUS:
+    EvalResult BinaryExpr::evaluate(Interpreter& interpreter){
+        EvalResult left_result = left->evaluate(interpreter), right_result = right->evaluate(interpreter);
+        bool two_numbers = is_number(left_result) && is_number(right_result);
+
+        switch (quickening){
+            case Quickening::UNOBSERVED:
+                quicken(left_result, right_result);
+                return evaluate_generic(left_result, right_result);
+            case Quickening::GENERIC:
+                return evaluate_generic(left_result, right_result);
+            case Quickening::ADD_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) + as_double(right_result);
                 }
-                else if (two_strings){
-                    ostringstream concat_stream;
-                    concat_stream << as_string(left_result) << as_string(right_result);
-                    return concat_stream.str();
-                }
                 break;
-            case MINUS:
+            case Quickening::SUB_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) - as_double(right_result);
                 }
                 break;
-            case STAR:
+            case Quickening::MUL_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) * as_double(right_result);
                 }
                 break;
-            case SLASH:
+            case Quickening::DIV_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) / as_double(right_result);
                 }
                 break;
-            case LESS:
+            case Quickening::LESS_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) < as_double(right_result);
                 }
-                else{
-                    throw parse_error(70, "Unsupported operation.\0");
-                }
-            case GREATER:
+                break;
+            case Quickening::GREATER_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) > as_double(right_result);
                 }
-                else{
-                    throw parse_error(70, "Unsupported operation.\0");
-                }
-            case LESS_EQUAL:
+                break;
+            case Quickening::LESS_EQUAL_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) <= as_double(right_result);
                 }
-                else{
-                    throw parse_error(70, "Unsupported operation.\0");
-                }
-            case GREATER_EQUAL:
+                break;
+            case Quickening::GREATER_EQUAL_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) >= as_double(right_result);
                 }
-                else {
-                    throw parse_error(70, "Unsupported operation.\0");
-                }
-            case EQUALITY:
+                break;
+            case Quickening::EQUAL_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) == as_double(right_result);
                 }
-                else if (two_bools){
-                    return as_bool(left_result) == as_bool(right_result);
-                }
-                else if (two_strings){
-                    return as_string(left_result) == as_string(right_result);
-                }
-                return false;
-            case INEQUALITY:
+                break;
+            case Quickening::NOT_EQUAL_NUM_NUM:
                 if (two_numbers){
                     return as_double(left_result) != as_double(right_result);
                 }
-                else if (two_bools){
-                    return as_bool(left_result) != as_bool(right_result);
-                }
-                else if (two_strings){
-                    return as_string(left_result) != as_string(right_result);
+                break;
+            case Quickening::ADD_STR_STR:
+                if (is_string(left_result) && is_string(right_result)){
+                    return EvalResult::concat_strings(left_result, right_result);
                 }
-                return true;
-            default:
-                throw parse_error(70, "Unsupported operation.\0");
+                break;
         }
-        throw parse_error(70, "Unsupported operation.\0");
+
+        // The operand types changed since the node was specialised, so it goes back to the generic path for good
+        // rather than switching between specialisations.
+        quickening = Quickening::GENERIC;
+        return evaluate_generic(left_result, right_result);
     }
 
-    EvalResult BinaryExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
+    void BinaryExpr::quicken(const EvalResult& left_result, const EvalResult& right_result){
         using enum Operator;
-        EvalResult left_result = left->evaluate(interpreter), right_result = right->evaluate(interpreter);
-        bool two_numbers = holds_alternative<double>(left_result) && holds_alternative<double>(right_result);
-        bool two_bools = holds_alternative<bool>(left_result) && holds_alternative<bool>(right_result);
-        bool two_strings = holds_alternative<string>(left_result) && holds_alternative<string>(right_result);
+        quickening = Quickening::GENERIC;
+        if (is_number(left_result) && is_number(right_result)){
+            switch (op){
+                case PLUS:
+                    quickening = Quickening::ADD_NUM_NUM;
+                    break;
+                case MINUS:
+                    quickening = Quickening::SUB_NUM_NUM;
+                    break;
+                case STAR:
+                    quickening = Quickening::MUL_NUM_NUM;
+                    break;
+                case SLASH:
+                    quickening = Quickening::DIV_NUM_NUM;
+                    break;
+                case LESS:
+                    quickening = Quickening::LESS_NUM_NUM;
+                    break;
+                case GREATER:
+                    quickening = Quickening::GREATER_NUM_NUM;
+                    break;
+                case LESS_EQUAL:
+                    quickening = Quickening::LESS_EQUAL_NUM_NUM;
+                    break;
+                case GREATER_EQUAL:
+                    quickening = Quickening::GREATER_EQUAL_NUM_NUM;
+                    break;
+                case EQUALITY:
+                    quickening = Quickening::EQUAL_NUM_NUM;
+                    break;
+                case INEQUALITY:
+                    quickening = Quickening::NOT_EQUAL_NUM_NUM;
+                    break;
+                default:
+                    break;
+            }
+        }
+        else if (op == PLUS && is_string(left_result) && is_string(right_result)){
+            quickening = Quickening::ADD_STR_STR;
+        }
+    }
+
+    EvalResult BinaryExpr::evaluate_generic(const EvalResult& left_result, const EvalResult& right_result) const{
+        using enum Operator;
+        bool two_numbers = is_number(left_result) && is_number(right_result);
+        bool two_bools = is_boolean(left_result) && is_boolean(right_result);
+        bool two_strings = is_string(left_result) && is_string(right_result);
+        bool two_nils = left_result.is_nil() && right_result.is_nil();
 
         switch (op){
             case PLUS:
@@ -208,9 +259,7 @@ namespace lox::ast{
                     return as_double(left_result) + as_double(right_result);
                 }
                 else if (two_strings){
-                    ostringstream concat_stream;
-                    concat_stream << as_string(left_result) << as_string(right_result);
-                    return concat_stream.str();
+                    return EvalResult::concat_strings(left_result, right_result);
                 }
                 break;
             case MINUS:
@@ -264,9 +313,9 @@ namespace lox::ast{
                     return as_bool(left_result) == as_bool(right_result);
                 }
                 else if (two_strings){
-                    return as_string(left_result) == as_string(right_result);
+                    return EvalResult::strings_equal(left_result, right_result);
                 }
-                return false;
+                return two_nils;
             case INEQUALITY:
                 if (two_numbers){
                     return as_double(left_result) != as_double(right_result);
@@ -275,9 +324,9 @@ namespace lox::ast{
                     return as_bool(left_result) != as_bool(right_result);
                 }
                 else if (two_strings){
-                    return as_string(left_result) != as_string(right_result);
+                    return !EvalResult::strings_equal(left_result, right_result);
                 }
-                return true;
+                return !two_nils;
             default:
                 throw parse_error(70, "Unsupported operation.\0");
         }
@@ -290,44 +339,15 @@ namespace lox::ast{
         return "(" + _OP_TO_SYM.at(op) + " " + operand->to_string() + ")";
     }
 
-    EvalResult UnaryExpr::evaluate(const shared_ptr<Environment>& env){
-        EvalResult evaluated_operand = operand->evaluate(env);
-
-        if (holds_alternative<bool>(evaluated_operand)){
-            if (op == Operator::BANG){
-                return !as_bool(evaluated_operand);
-            }
-        }
-        else if (holds_alternative<double>(evaluated_operand)){
-            switch (op){
-                case Operator::MINUS:
-                    return -as_double(evaluated_operand);
-                case Operator::BANG:
-                    return false;
-                default:
-                    break;
-            }
-        }
-        else{
-            switch (op){
-                case Operator::BANG:
-                    return as_string(evaluated_operand) == "nil";
-                default:
-                    break;
-            }
-        }
-        throw parse_error(70, "Invalid operand for unary expression.\0");
-    }
-
-    EvalResult UnaryExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
+    EvalResult UnaryExpr::evaluate(Interpreter& interpreter){
         EvalResult evaluated_operand = operand->evaluate(interpreter);
 
-        if (holds_alternative<bool>(evaluated_operand)){
+        if (is_boolean(evaluated_operand)){
             if (op == Operator::BANG){
                 return !as_bool(evaluated_operand);
             }
         }
-        else if (holds_alternative<double>(evaluated_operand)){
+        else if (is_number(evaluated_operand)){
             switch (op){
                 case Operator::MINUS:
                     return -as_double(evaluated_operand);
@@ -340,7 +360,7 @@ namespace lox::ast{
         else{
             switch (op){
                 case Operator::BANG:
-                    return as_string(evaluated_operand) == "nil";
+                    return evaluated_operand.is_nil();
                 default:
                     break;
             }
@@ -350,55 +370,34 @@ namespace lox::ast{
     // endregion
 
     // region VariableExpr
-    // Using const references to shared pointers to make absolutely SURE memory doesn't get out of hand when
-    // handing a pointer to the environment object.
-    VariableExpr::VariableExpr(const Token& id_token): AbstractVarExpr(id_token.get_lexeme()){
+    VariableExpr::VariableExpr(const Token& id_token): AbstractVarExpr(ExprKind::VARIABLE, id_token.get_lexeme()){
         if (id_token.get_token_type() != TokenType::IDENTIFIER){
             throw parse_error(65, "Invalid token type for variable expression.");
         }
     }
 
-    EvalResult VariableExpr::evaluate(const shared_ptr<Environment>& env){
-        return env->get(name);
-    }
-
-    EvalResult VariableExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
-        return look_up_var(interpreter, name, shared_from_this());
+    EvalResult VariableExpr::evaluate(Interpreter& interpreter){
+        return look_up_var(interpreter, location);
     }
     // endregion
 
     // region AssignmentExpr
-    AssignmentExpr::AssignmentExpr(const string& name, shared_ptr<Expr> value)
-            : AbstractVarExpr(name), value(std::move(value)){}
+    AssignmentExpr::AssignmentExpr(const string& name, Expr* value)
+            : AbstractVarExpr(ExprKind::ASSIGNMENT, name), value(value){}
 
-    EvalResult AssignmentExpr::evaluate(const shared_ptr<Environment>& env){
-        EvalResult val = value->evaluate(env);
-        env->assign(name, val);
-        return val;
+    string AssignmentExpr::to_string() const{
+        return name + " = " + value->to_string();
     }
 
-    EvalResult AssignmentExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
+    EvalResult AssignmentExpr::evaluate(Interpreter& interpreter){
         EvalResult evaled = value->evaluate(interpreter);
-        assign_var(interpreter, name, value);
+        assign_var(interpreter, location, evaled);
         return evaled;
     }
     // endregion
 
     // region LogicalExpr
-    EvalResult LogicalExpr::evaluate(const shared_ptr<Environment>& env){
-        EvalResult left_evaled = left->evaluate(env);
-
-        switch (op){
-            case Operator::OR:
-                return (is_truthy(left_evaled) ? left_evaled : right->evaluate(env));
-            case Operator::AND:
-                return (is_truthy(left_evaled) ? right->evaluate(env) : left_evaled);
-            default:
-                unreachable();
-        }
-    }
-
-    EvalResult LogicalExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
+    EvalResult LogicalExpr::evaluate(Interpreter& interpreter){
         EvalResult left_evaled = left->evaluate(interpreter);
 
         switch (op){
@@ -413,8 +412,10 @@ namespace lox::ast{
     // endregion
 
     // region CallExpr
-    CallExpr::CallExpr(const shared_ptr<Expr>& callee, const vector<shared_ptr<Expr>>& args)
-            : callee(callee), args(args){}
+    CallExpr::CallExpr(Expr* callee, const vector<Expr*>& args)
+            : Expr(ExprKind::CALL), callee(callee), args(args),
+            attr_callee(callee->get_kind() == ExprKind::GET_ATTR ? static_cast<GetAttrExpr*>(callee) : nullptr),
+            super_callee(callee->get_kind() == ExprKind::SUPER ? static_cast<SuperExpr*>(callee) : nullptr){}
 
     string CallExpr::to_string() const{
         auto ret = callee->to_string() + "(";
@@ -430,32 +431,19 @@ namespace lox::ast{
         return ret;
     };
 
-    EvalResult CallExpr::evaluate(const shared_ptr<Environment>& env){
-        EvalResult callee_eval = callee->evaluate(env);
-
-        if (!is_callable(callee_eval)){
-            throw runtime_error("Given object is not callable.");
+    EvalResult CallExpr::evaluate(Interpreter& interpreter){
+        InstancePtr receiver;
+        EvalResult callee_eval;
+        if (attr_callee != nullptr){
+            callee_eval = attr_callee->evaluate_unbound(interpreter, receiver);
         }
-
-        vector<EvalResult> args_evaled;
-        args_evaled.reserve(args.size());
-        for (const auto& arg: args){
-            args_evaled.push_back(arg->evaluate(env));
+        else if (super_callee != nullptr){
+            callee_eval = super_callee->evaluate_unbound(interpreter, receiver);
         }
-
-
-        CallablePtr func = as_func(callee_eval);
-
-        if (args_evaled.size() != func->arity()){
-            throw runtime_error("Expected " + std::to_string(func->arity()) + " arguments, got " + std::to_string(args_evaled.size()));
+        else{
+            callee_eval = callee->evaluate(interpreter);
         }
 
-        return func->call(env, args_evaled);
-    }
-
-    EvalResult CallExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
-        EvalResult callee_eval = callee->evaluate(interpreter);
-
         if (!is_callable(callee_eval)){
             throw runtime_error("Given object is not callable.");
         }
@@ -473,13 +461,16 @@ namespace lox::ast{
             throw runtime_error("Expected " + std::to_string(func->arity()) + " arguments, got " + std::to_string(args_evaled.size()));
         }
 
+        if (receiver != nullptr){
+            return func->invoke(interpreter, receiver, args_evaled);
+        }
         return func->call(interpreter, args_evaled);
     }
     // endregion
 
     // region AbstractInstAccessExpr
-    AbstractInstAccessExpr::AbstractInstAccessExpr(const shared_ptr<Expr>& target, const Token& attr)
-    : obj(target), attr_name(attr.get_lexeme()), attr_token(attr){
+    AbstractInstAccessExpr::AbstractInstAccessExpr(ExprKind kind, Expr* target, const Token& attr)
+    : Expr(kind), obj(target), attr_name(attr.get_lexeme()), attr_token(attr), attr_id(lox::symbols::intern(attr_name)){
         if (attr.get_token_type() != TokenType::IDENTIFIER){
             throw parse_error(65, "An identifier is required for a GetAttr expression.");
         }
@@ -491,237 +482,188 @@ namespace lox::ast{
     // endregion
 
     // region GetAttrExpr
-    GetAttrExpr::GetAttrExpr(const shared_ptr<Expr>& target, const Token& attr): AbstractInstAccessExpr(target, attr){}
+    GetAttrExpr::GetAttrExpr(Expr* target, const Token& attr): AbstractInstAccessExpr(ExprKind::GET_ATTR, target, attr){}
 
     string GetAttrExpr::to_string() const{
         return AbstractInstAccessExpr::to_string();
     }
 
-    EvalResult GetAttrExpr::evaluate(const shared_ptr<Environment>& env){
-        EvalResult object = obj->evaluate(env);
-        if (holds_alternative<InstancePtr>(object)){
-            return as_cls_inst(object)->get_attr(attr_name);
+    EvalResult GetAttrExpr::evaluate(Interpreter& interpreter){
+        EvalResult object = obj->evaluate(interpreter);
+        if (is_cls_inst(object)){
+            return as_cls_inst(object)->get_attr(attr_id, cache);
         }
         throw runtime_error("Can only access attributes from class instances.");
     }
 
-    EvalResult GetAttrExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
+    EvalResult GetAttrExpr::evaluate_unbound(Interpreter& interpreter, InstancePtr& receiver){
         EvalResult object = obj->evaluate(interpreter);
-        if (holds_alternative<InstancePtr>(object)){
-            return as_cls_inst(object)->get_attr(attr_name);
+        if (!is_cls_inst(object)){
+            throw runtime_error("Can only access attributes from class instances.");
         }
-        throw runtime_error("Can only access attributes from class instances.");
+        InstancePtr inst = as_cls_inst(object);
+        CallablePtr method = inst->find_method(attr_id, cache);
+        if (method == nullptr){
+            return inst->get_attr(attr_id, cache);  // A field, or a missing property.
+        }
+        receiver = std::move(inst);
+        return method;
     }
     // endregion
 
     // region SetAttrExpr
-    SetAttrExpr::SetAttrExpr(const shared_ptr<Expr>& target, const Token& attr, const shared_ptr<Expr>& value)
-    : AbstractInstAccessExpr(target, attr), value(value){}
+    SetAttrExpr::SetAttrExpr(Expr* target, const Token& attr, Expr* value)
+    : AbstractInstAccessExpr(ExprKind::SET_ATTR, target, attr), value(value){}
 
     string SetAttrExpr::to_string() const{
         return AbstractInstAccessExpr::to_string() + " = " + value->to_string();
     }
 
-    EvalResult SetAttrExpr::evaluate(const shared_ptr<Environment>& env){
-        EvalResult object = obj->evaluate(env);
-
-        if (!holds_alternative<InstancePtr>(object)){
-            throw runtime_error("Cannot access fields from non-instance values.");
-        }
-
-        EvalResult val = value->evaluate(env);
-        as_cls_inst(object)->set_attr(attr_name, val);
-        return val;
-    }
-
-    EvalResult SetAttrExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
+    EvalResult SetAttrExpr::evaluate(Interpreter& interpreter){
         EvalResult object = obj->evaluate(interpreter);
 
-        if (!holds_alternative<InstancePtr>(object)){
+        if (!is_cls_inst(object)){
             throw runtime_error("Cannot access fields from non-instance values.");
         }
 
         EvalResult val = value->evaluate(interpreter);
-        as_cls_inst(object)->set_attr(attr_name, val);
+        as_cls_inst(object)->set_attr(attr_id, val, cache);
         return val;
     }
     // endregion
 
     // region ThisExpr
-    EvalResult ThisExpr::evaluate(const shared_ptr<Environment>& env){
-        return env->get("this");
-    }
-
-    EvalResult ThisExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
-        return look_up_var(interpreter, "this", shared_from_this());
+    EvalResult ThisExpr::evaluate(Interpreter& interpreter){
+        return look_up_var(interpreter, location);
     }
     // endregion
 
     // region SuperExpr
     SuperExpr::SuperExpr(const Token& kw, const Token& meth)
-    : kw(kw), meth(meth){
+    : Expr(ExprKind::SUPER), kw(kw), meth(meth), meth_id(lox::symbols::intern(meth.get_lexeme())){
         if (kw.get_token_type() != TokenType::SUPER || meth.get_token_type() != TokenType::IDENTIFIER){
             throw parse_error(65, "Super expression built from wrong token type.");
         }
     }
 
-    EvalResult SuperExpr::evaluate(const shared_ptr<Environment>& env){
-        return "nil";
+    EvalResult SuperExpr::evaluate(Interpreter& interpreter){
+        InstancePtr obj;
+        CallablePtr method = as_func(evaluate_unbound(interpreter, obj));
+        return method->bind(obj);
     }
 
-    EvalResult SuperExpr::evaluate(const shared_ptr<Interpreter>& interpreter){
-        auto shared = dynamic_pointer_cast<SuperExpr>(shared_from_this());
-        size_t dist = get_super_dist(interpreter, shared);
-
-        EvalResult cls_evaled = get_current_env(interpreter)->get_at(dist, "super");
-        ClassPtr super_cls = dynamic_pointer_cast<LoxClass>(as_func(cls_evaled));
-        InstancePtr obj = as_cls_inst(
-            get_current_env(interpreter)->get_at(dist - 1, "this")
-        );
+    EvalResult SuperExpr::evaluate_unbound(Interpreter& interpreter, InstancePtr& receiver){
+        // 'super' is only ever defined by ClassStmt::make_class, once it has checked the superclass is a class.
+        EvalResult cls_evaled = look_up_var(interpreter, location);
+        ClassPtr super_cls = static_obj_cast<LoxClass>(as_func(cls_evaled));
 
-        shared_ptr<LoxFunction> method = super_cls->find_meth(meth.get_lexeme());
+        CallablePtr method = super_cls->find_meth(meth_id);
 
         if (method == nullptr){
             throw runtime_error("Undefined property '" + meth.get_lexeme() + "'.");
         }
 
-        return method->bind(obj);
+        receiver = as_cls_inst(look_up_var(interpreter, this_location));
+        return method;
     }
     // endregion
 
+    // Joins the display of the given statements, each preceded by a space.
+    static string stmts_to_string(const vector<Statement*>& statements){
+        string ret;
+        for (const auto& stmt: statements){
+            ret += " " + stmt->to_string();
+        }
+        return ret;
+    }
+
     // region ExprStatement
-    void ExprStatement::execute(const shared_ptr<Environment>& env){
-        EvalResult result = expr->evaluate(env);
+    string ExprStatement::to_string() const{
+        return "(expr " + expr->to_string() + ")";
     }
 
-    void ExprStatement::execute(const shared_ptr<Interpreter>& interpreter){
+    Completion ExprStatement::execute(Interpreter& interpreter){
         EvalResult result = expr->evaluate(interpreter);
+        return Completion::normal();
     }
     // endregion
 
     // region PrintStatement
-    void PrintStatement::execute(const shared_ptr<Environment>& env){
-        EvalResult result = expr->evaluate(env);
-        if (holds_alternative<bool>(result)){
-            cout << boolalpha << as_bool(result) << noboolalpha << endl;
-        }
-        else if (holds_alternative<double>(result)){
-            auto previous = cout.precision();
-            bool is_integer = static_cast<int>(as_double(result)) == as_double(result);
-            if (is_integer){
-                cout << fixed << setprecision(0);
-            }
-            cout << as_double(result) << endl;
-            if (is_integer){
-                cout << setprecision(static_cast<int>(previous));
-                cout.unsetf(std::ios_base::fixed);
-            }
-        }
-        else if (holds_alternative<CallablePtr>(result)){
-            cout << as_func(result)->to_string() << endl;
-        }
-        else if (holds_alternative<InstancePtr>(result)){
-            cout << as_cls_inst(result)->to_string() << endl;
-        }
-        else{
-            cout << as_string(result) << endl;
-        }
+    string PrintStatement::to_string() const{
+        return "(print " + expr->to_string() + ")";
     }
 
-    void PrintStatement::execute(const shared_ptr<Interpreter>& interpreter){
-        EvalResult result = expr->evaluate(interpreter);
-        if (holds_alternative<bool>(result)){
-            cout << (as_bool(result) ? "true" : "false") << endl;
-        }
-        else if (holds_alternative<double>(result)){
-            auto previous = cout.precision();
-            bool is_integer = static_cast<int>(as_double(result)) == as_double(result);
-            if (is_integer){
-                cout << fixed << setprecision(0);
-            }
-            cout << as_double(result) << endl;
-            if (is_integer){
-                cout << setprecision(static_cast<int>(previous));
-                cout.unsetf(std::ios_base::fixed);
-            }
-        }
-        else if (holds_alternative<CallablePtr>(result)){
-            cout << as_func(result)->to_string() << endl;
-        }
-        else if (holds_alternative<InstancePtr>(result)){
-            cout << as_cls_inst(result)->to_string() << endl;
-        }
-        else{
-            cout << as_string(result) << endl;
-        }
+    Completion PrintStatement::execute(Interpreter& interpreter){
+        print_value(expr->evaluate(interpreter));
+        return Completion::normal();
     }
     // endregion
 
     // region VariableStatement
-    VariableStatement::VariableStatement(const string& name, shared_ptr<Expr> init_expr): name(name), StatementWithExpr(init_expr){}  // NOLINT
+    VariableStatement::VariableStatement(const string& name, Expr* init_expr): name(name), location(global_location(name)), StatementWithExpr(StmtKind::VARIABLE, init_expr){}  // NOLINT
 
-    void VariableStatement::execute(const shared_ptr<Environment>& env){
-        EvalResult val = "nil";
-        if (expr != nullptr){
-            val = expr->evaluate(env);
+    string VariableStatement::to_string() const{
+        if (expr == nullptr){
+            return "(var " + name + ")";
         }
-
-        env->set(name, val);
+        return "(var " + name + " " + expr->to_string() + ")";
     }
 
-    void VariableStatement::execute(const shared_ptr<Interpreter>& interpreter){
-        EvalResult val = "nil";
+    Completion VariableStatement::execute(Interpreter& interpreter){
+        EvalResult val;  // Uninitialised variables hold nil.
         if (expr != nullptr){
             val = expr->evaluate(interpreter);
         }
 
-        get_current_env(interpreter)->set(name, val);
+        define_var(interpreter, location, val);
+        return Completion::normal();
     }
     // endregion
 
     // region BlockStatement
-    BlockStatement::BlockStatement(vector<shared_ptr<Statement>> statements)
-            : statements(std::move(statements)){}
+    BlockStatement::BlockStatement(vector<Statement*> statements)
+            : Statement(StmtKind::BLOCK), statements(std::move(statements)){}
 
-    void BlockStatement::execute(const shared_ptr<Environment>& env){
-        shared_ptr<Environment> child_env = make_shared<Environment>(env);
-        for (const auto& stmt: statements){
-            stmt->execute(child_env);
-        }
+    string BlockStatement::to_string() const{
+        return "(block" + stmts_to_string(statements) + ")";
     }
 
-    void BlockStatement::execute(const shared_ptr<Interpreter>& interpreter){
-        add_nesting_level(interpreter);
+    Completion BlockStatement::execute(Interpreter& interpreter){
         for (const auto& stmt: statements){
-            stmt->execute(interpreter);
+            Completion completion = stmt->execute(interpreter);
+            if (completion.is_return){
+                return completion;  // Returning pops the whole frame, which closes its upvalues.
+            }
         }
-        remove_nesting_level(interpreter);
+        // Closures created in the block keep their own copy of the variables it declared.
+        if (closes_upvalues){
+            close_upvalues(interpreter, first_slot);
+        }
+        return Completion::normal();
     }
     // endregion
 
     // region AbstractLogicalStmt
-    AbstractLogicalStmt::AbstractLogicalStmt(shared_ptr<Expr> condition, shared_ptr<Statement> success)
-            : condition(std::move(condition)), on_success(std::move(success)){}
+    AbstractLogicalStmt::AbstractLogicalStmt(StmtKind kind, Expr* condition, Statement* success)
+            : Statement(kind), condition(condition), on_success(success){}
     // endregion
 
     // region IfStatement
-    IfStatement::IfStatement(shared_ptr<Expr> condition, shared_ptr<Statement> success, shared_ptr<Statement> failure)
-            : AbstractLogicalStmt(std::move(condition), std::move(success)), on_failure(std::move(failure)){}
+    IfStatement::IfStatement(Expr* condition, Statement* success, Statement* failure)
+            : AbstractLogicalStmt(StmtKind::IF, condition, success), on_failure(failure){}
 
-    IfStatement::IfStatement(shared_ptr<Expr> condition, shared_ptr<Statement> success)
-            : AbstractLogicalStmt(std::move(condition), std::move(success)), on_failure(nullptr){}
+    IfStatement::IfStatement(Expr* condition, Statement* success)
+            : AbstractLogicalStmt(StmtKind::IF, condition, success), on_failure(nullptr){}
 
-    void IfStatement::execute(const shared_ptr<Environment>& env){
-        EvalResult condit_evaled = condition->evaluate(env);
-        if (is_truthy(condit_evaled)){
-            return on_success->execute(env);
-        }
+    string IfStatement::to_string() const{
+        string ret = "(if " + condition->to_string() + " " + on_success->to_string();
         if (on_failure != nullptr){
-            return on_failure->execute(env);
+            ret += " " + on_failure->to_string();
         }
+        return ret + ")";
     }
 
-    void IfStatement::execute(const shared_ptr<Interpreter>& interpreter){
+    Completion IfStatement::execute(Interpreter& interpreter){
         EvalResult condit_evaled = condition->evaluate(interpreter);
         if (is_truthy(condit_evaled)){
             return on_success->execute(interpreter);
@@ -729,84 +671,88 @@ namespace lox::ast{
         if (on_failure != nullptr){
             return on_failure->execute(interpreter);
         }
+        return Completion::normal();
     }
     // endregion
 
     // region WhileStatement
-    WhileStatement::WhileStatement(shared_ptr<Expr> condition, shared_ptr<Statement> success)
-            : AbstractLogicalStmt(std::move(condition), std::move(success)){}
+    WhileStatement::WhileStatement(Expr* condition, Statement* success)
+            : AbstractLogicalStmt(StmtKind::WHILE, condition, success){}
 
-    void WhileStatement::execute(const shared_ptr<Environment>& env){
-        while (is_truthy(condition->evaluate(env))){
-            on_success->execute(env);
-        }
+    string WhileStatement::to_string() const{
+        return "(while " + condition->to_string() + " " + on_success->to_string() + ")";
     }
 
-    void WhileStatement::execute(const shared_ptr<Interpreter>& interpreter){
+    Completion WhileStatement::execute(Interpreter& interpreter){
         while (is_truthy(condition->evaluate(interpreter))){
-            on_success->execute(interpreter);
+            Completion completion = on_success->execute(interpreter);
+            if (completion.is_return){
+                return completion;
+            }
+            lox::gc::Heap::get().collect_if_needed();
         }
+        return Completion::normal();
     }
     // endregion
 
     // region FunctionStmt
-    FunctionStmt::FunctionStmt(const Token& id_token, const vector<Token>& args, const vector<shared_ptr<Statement>>& body)
-    : args(args), body(body){
+    // Creates the upvalues of a closure declared in the running function.
+    static vector<UpvaluePtr> capture_upvalues(Interpreter& interpreter, const FunctionStmt* func_stmt){
+        vector<UpvaluePtr> captured;
+        captured.reserve(func_stmt->get_upvalues().size());
+        for (const auto& upvalue: func_stmt->get_upvalues()){
+            captured.push_back(
+                upvalue.is_local ? capture_upvalue(interpreter, upvalue.index) : get_upvalue(interpreter, upvalue.index)
+            );
+        }
+        return captured;
+    }
+
+    FunctionStmt::FunctionStmt(const Token& id_token, const vector<Token>& args, const vector<Statement*>& body)
+    : Statement(StmtKind::FUNCTION), args(args), body(body){
         name = id_token.get_lexeme();
+        location = global_location(name);
         if (args.size() >= 255){
             throw invalid_argument("Cannot have 255 parameters or more in a function.");
         }
     }
 
-    void FunctionStmt::execute(const shared_ptr<Environment>& env){
-        shared_ptr<Statement> shared = shared_from_this();
-        env->set(
-            name,
-            make_shared<LoxFunction>(shared, env, false)
-        );
+    string FunctionStmt::to_string() const{
+        string params;
+        for (const auto& arg: args){
+            params += (params.empty() ? "" : " ") + arg.get_lexeme();
+        }
+        return "(fun " + name + " (" + params + ")" + stmts_to_string(body) + ")";
     }
 
-    void FunctionStmt::execute(const shared_ptr<Interpreter>& interpreter){
-        execute(get_current_env(interpreter));
+    Completion FunctionStmt::execute(Interpreter& interpreter){
+        define_var(interpreter, location, make_obj<LoxFunction>(this, capture_upvalues(interpreter, this), false));
+        return Completion::normal();
     }
 
     namespace for_callable{
-        EvalResult exec_func_body(const shared_ptr<Environment>& env, const shared_ptr<Statement>& func_stmt){
-            auto as_func_stmt = dynamic_pointer_cast<FunctionStmt>(func_stmt);
-            if (as_func_stmt == nullptr){
-                return "nil";
-            }
-
-            try {
-                for (const auto& stmt: as_func_stmt->body){
-                    stmt->execute(env);
-                }
-                return "nil";
-            }
-            catch (const return_exc& returned_exc){
-                return returned_exc.get_returned_val();
-            }
+        // These run on every call, so they check the kind tag instead of going through RTTI.
+        static FunctionStmt* as_function_stmt(Statement* stmt){
+            return stmt->get_kind() == StmtKind::FUNCTION ? static_cast<FunctionStmt*>(stmt) : nullptr;
         }
 
-        EvalResult exec_func_body(const shared_ptr<Interpreter>& interpreter, const shared_ptr<Statement>& func_stmt){
-            auto as_func_stmt = dynamic_pointer_cast<FunctionStmt>(func_stmt);
+        EvalResult exec_func_body(Interpreter& interpreter, Statement* func_stmt){
+            auto as_func_stmt = as_function_stmt(func_stmt);
             if (as_func_stmt == nullptr){
-                return "nil";
+                return EvalResult::nil();
             }
 
-            try {
-                for (const auto& stmt: as_func_stmt->body){
-                    stmt->execute(interpreter);
+            for (const auto& stmt: as_func_stmt->body){
+                Completion completion = stmt->execute(interpreter);
+                if (completion.is_return){
+                    return std::move(completion.value);
                 }
-                return "nil";
-            }
-            catch (const return_exc& returned_exc){
-                return returned_exc.get_returned_val();
             }
+            return EvalResult::nil();
         }
 
-        string get_func_name(const shared_ptr<Statement>& func_stmt){
-            auto as_func_stmt = dynamic_pointer_cast<FunctionStmt>(func_stmt);
+        string get_func_name(Statement* func_stmt){
+            auto as_func_stmt = as_function_stmt(func_stmt);
             if (as_func_stmt != nullptr) {
                 return as_func_stmt->name;
             }
@@ -814,9 +760,9 @@ namespace lox::ast{
             return "";
         }
 
-        vector<Token> get_args(const shared_ptr<Statement>& func_stmt) {
+        vector<Token> get_args(Statement* func_stmt) {
             vector<Token> ret;
-            auto as_func_stmt = dynamic_pointer_cast<FunctionStmt>(func_stmt);
+            auto as_func_stmt = as_function_stmt(func_stmt);
             if (as_func_stmt == nullptr) {
                 return ret;
             }
@@ -824,55 +770,71 @@ namespace lox::ast{
             return {as_func_stmt->args};
         }
 
-        ubyte get_arg_count(const shared_ptr<Statement>& func_stmt) {
-            auto as_func_stmt = dynamic_pointer_cast<FunctionStmt>(func_stmt);
+        ubyte get_arg_count(Statement* func_stmt) {
+            auto as_func_stmt = as_function_stmt(func_stmt);
             if (as_func_stmt == nullptr) {
                 return 0;
             }
             return as_func_stmt->get_arg_count();
         }
+
+        size_t get_frame_size(Statement* func_stmt){
+            auto as_func_stmt = as_function_stmt(func_stmt);
+            if (as_func_stmt == nullptr){
+                return 0;
+            }
+            return as_func_stmt->frame_size;
+        }
     }
     // endregion
 
     // region ReturnStmt
-    void ReturnStmt::execute(const shared_ptr<Environment>& env){
+    string ReturnStmt::to_string() const{
         if (expr == nullptr){
-            throw return_exc("nil");
+            return "(return)";
         }
-        throw return_exc(expr->evaluate(env));
+        return "(return " + expr->to_string() + ")";
     }
 
-    void ReturnStmt::execute(const shared_ptr<Interpreter>& interpreter){
+    Completion ReturnStmt::execute(Interpreter& interpreter){
         if (expr == nullptr){
-            throw return_exc("nil");
+            return Completion::returned(EvalResult::nil());
         }
-        throw return_exc(expr->evaluate(interpreter));
+        return Completion::returned(expr->evaluate(interpreter));
     }
     // endregion
 
     // region ClassStmt
-    ClassStmt::ClassStmt(const Token& id_token, const shared_ptr<VariableExpr>& superclass, const vector<shared_ptr<FunctionStmt>>& meths)
-    : name(id_token.get_lexeme()), super_cls(superclass), methods(meths){
+    ClassStmt::ClassStmt(const Token& id_token, VariableExpr* superclass, const vector<FunctionStmt*>& meths)
+    : Statement(StmtKind::CLASS), name(id_token.get_lexeme()), super_cls(superclass), methods(meths), location(global_location(name)){
         if (id_token.get_token_type() != TokenType::IDENTIFIER){
             throw parse_error(65, "Classes must be declared using non-literal values.\0");
         }
     }
 
-    void ClassStmt::execute(const shared_ptr<Environment>& env){
-        shared_ptr<LoxClass> supercls_as_cls = nullptr;
-        auto current_env = env;
+    string ClassStmt::to_string() const{
+        string ret = "(class " + name;
         if (super_cls != nullptr){
-            EvalResult superclass = super_cls->evaluate(current_env);
-            if (!holds_alternative<CallablePtr>(superclass)) {
+            ret += " < " + super_cls->to_string();
+        }
+        for (const auto& meth: methods){
+            ret += " " + meth->to_string();
+        }
+        return ret + ")";
+    }
+
+    CallablePtr ClassStmt::make_class(Interpreter& interpreter, const EvalResult& superclass) const{
+        ClassPtr supercls_as_cls = nullptr;
+        if (super_cls != nullptr){
+            if (!is_callable(superclass)) {
                 throw runtime_error("Superclass must be a class.");
             } else {
                 CallablePtr as_callable = as_func(superclass);
-                supercls_as_cls = dynamic_pointer_cast<LoxClass>(as_callable);
-                if (supercls_as_cls == nullptr) {
+                if (as_callable->get_kind() != CallableKind::CLASS) {
                     throw runtime_error("Superclass must be a class.");
                 }
-                current_env = make_shared<Environment>(env);
-                current_env->set("super", as_callable);
+                supercls_as_cls = static_obj_cast<LoxClass>(as_callable);
+                define_var(interpreter, super_location, as_callable);
             }
         }
 
@@ -883,19 +845,24 @@ namespace lox::ast{
             meth_map.insert(
                 {
                     meth_decl->get_name(),
-                    make_shared<LoxFunction>(meth_decl, current_env, meth_decl->get_name() == "init")
+                    make_obj<LoxFunction>(meth_decl, capture_upvalues(interpreter, meth_decl), meth_decl->get_name() == "init", true)
                 }
             );
         }
 
-        env->set(
-            name,
-            make_shared<LoxClass>(name, supercls_as_cls, meth_map)
-        );
+        if (super_cls != nullptr && super_captured){
+            close_upvalues(interpreter, super_location.slot);  // The scope of 'super' ends with the class declaration.
+        }
+        return make_obj<LoxClass>(name, supercls_as_cls, meth_map);
     }
 
-    void ClassStmt::execute(const shared_ptr<Interpreter>& interpreter){
-        execute(get_current_env(interpreter));
+    Completion ClassStmt::execute(Interpreter& interpreter){
+        EvalResult superclass;
+        if (super_cls != nullptr){
+            superclass = super_cls->evaluate(interpreter);
+        }
+        define_var(interpreter, location, make_class(interpreter, superclass));
+        return Completion::normal();
     }
     // endregion
 }
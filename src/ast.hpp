@@ -18,90 +18,149 @@
 #include <variant>
 
 namespace lox::ast{
-    using std::enable_shared_from_this;
     using std::shared_ptr;
 
     class Expr;
 }
 
+namespace lox::optimizer{
+    class Optimizer;
+}
+
 namespace lox::interpreter{
     using lox::ast::Expr;
     using lox::callable::VarValue;
     using lox::env::Environment;
+    using lox::env::VarLocation;
+    using lox::value::Ref;
     using std::shared_ptr;
     using std::string;
 
     class Interpreter;
 
     namespace for_ast{
-        VarValue look_up_var(const shared_ptr<Interpreter>& interpreter, const string& name, const shared_ptr<Expr>& expr);
+        VarValue look_up_var(Interpreter& interpreter, const VarLocation& location);
 
-        void assign_var(const shared_ptr<Interpreter>& interpreter, const string& name, const shared_ptr<Expr>& expr);
+        void assign_var(Interpreter& interpreter, const VarLocation& location, VarValue value);
 
-        shared_ptr<Environment> get_current_env(const shared_ptr<Interpreter>& interpreter);
+        void define_var(Interpreter& interpreter, const VarLocation& location, VarValue value);
 
-        void add_nesting_level(const shared_ptr<Interpreter>& interpreter);
+        lox::env::UpvaluePtr get_upvalue(Interpreter& interpreter, size_t index);
 
-        void remove_nesting_level(const shared_ptr<Interpreter>& interpreter);
+        lox::env::UpvaluePtr capture_upvalue(Interpreter& interpreter, size_t slot);
+
+        void close_upvalues(Interpreter& interpreter, size_t slot);
     }
 }
 
 namespace lox::ast {
+    using lox::callable::CallableKind;
     using lox::callable::CallablePtr;
     using lox::callable::EvalResult;
     using lox::callable::InstancePtr;
+    using lox::callable::is_boolean;
+    using lox::callable::is_callable;
+    using lox::callable::is_cls_inst;
+    using lox::callable::is_number;
+    using lox::callable::is_string;
     using lox::callable::LoxClass;
     using lox::callable::LoxFunction;
     using lox::callable::MethodMap;
     using lox::env::Environment;
+    using lox::env::UpvaluePtr;
+    using lox::env::global_location;
+    using lox::env::VarLocation;
     using lox::inst::ClassPtr;
     using lox::inst::LoxInstance;
+    using lox::inst::PropertyCache;
+    using lox::symbols::SymbolId;
     using lox::interpreter::Interpreter;
     using lox::interpreter::for_ast::look_up_var;
     using lox::interpreter::for_ast::assign_var;
-    using lox::interpreter::for_ast::get_current_env;
-    using lox::interpreter::for_ast::add_nesting_level;
-    using lox::interpreter::for_ast::remove_nesting_level;
+    using lox::interpreter::for_ast::define_var;
+    using lox::interpreter::for_ast::get_upvalue;
+    using lox::interpreter::for_ast::capture_upvalue;
+    using lox::interpreter::for_ast::close_upvalues;
     using lox::tokenizer::token::Token;
     using lox::tokenizer::token::TokenType;
+    using lox::value::make_obj;
+    using lox::value::Ref;
+    using lox::value::static_obj_cast;
 
     using std::boolalpha;
     using std::cout;
     using std::cerr;
-    using std::dynamic_pointer_cast;
-    using std::enable_shared_from_this;
     using std::endl;
-    using std::fixed;
     using std::get;
     using std::invalid_argument;
     using std::make_shared;
     using std::noboolalpha;
     using std::ostringstream;
     using std::runtime_error;
-    using std::setprecision;
     using std::shared_ptr;
     using std::string;
     using std::unordered_map;
     using std::unreachable;
 
-#   define as_double get<double>
-#   define as_bool get<bool>
-#   define as_string get<string>
-#   define as_func get<CallablePtr>
-#   define as_cls_inst get<InstancePtr>
+    // Shorthands for the accessors of EvalResult. The value must hold the requested type.
+    inline double as_double(const EvalResult& val){
+        return val.as_number();
+    }
+
+    inline bool as_bool(const EvalResult& val){
+        return val.as_bool();
+    }
+
+    inline const string& as_string(const EvalResult& val){
+        return val.as_string();
+    }
+
+    inline CallablePtr as_func(const EvalResult& val){
+        return val.as_callable();
+    }
+
+    inline InstancePtr as_cls_inst(const EvalResult& val){
+        return val.as_instance();
+    }
 
     bool is_truthy(EvalResult eval_result);
 
+    // Writes the given value to the standard output, the way the print statement displays it.
+    void print_value(const EvalResult& result);
+
     // region Expressions
-    class Expr : public enable_shared_from_this<Expr> {
+    // Concrete type of an expression node, so that passes over the tree can switch on it instead of casting.
+    enum class ExprKind: ubyte{
+        LITERAL,
+        GROUP,
+        UNARY,
+        BINARY,
+        LOGICAL,
+        VARIABLE,
+        ASSIGNMENT,
+        CALL,
+        GET_ATTR,
+        SET_ATTR,
+        THIS,
+        SUPER
+    };
+
+    class Expr{
+        ExprKind kind;
+
+    protected:
+        explicit Expr(ExprKind kind): kind(kind){}
+
     public:
         virtual ~Expr() = default;
 
-        [[nodiscard]] virtual string to_string() const = 0;
+        [[nodiscard]] ExprKind get_kind() const{
+            return kind;
+        }
 
-        [[nodiscard]] virtual EvalResult evaluate(const shared_ptr<Environment> &env) = 0;
+        [[nodiscard]] virtual string to_string() const = 0;
 
-        [[nodiscard]] virtual EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) = 0;
+        [[nodiscard]] virtual EvalResult evaluate(Interpreter& interpreter) = 0;
     };
 
 
@@ -118,19 +177,23 @@ namespace lox::ast {
 
     // Literals
     class LiteralExpr : public Expr {
-        string value;
+        string value;  // Source representation, only used for display.
+        EvalResult decoded;  // Built once at parse time and handed out on every evaluation.
     public:
         LiteralExprType expr_type;
 
-        explicit LiteralExpr(LiteralExprType type) : expr_type(type) {}
+        explicit LiteralExpr(LiteralExprType type);
 
-        explicit LiteralExpr(LiteralExprType type, string value) : expr_type(type), value(std::move(value)) {}
+        LiteralExpr(LiteralExprType type, string value, EvalResult decoded)
+        : Expr(ExprKind::LITERAL), expr_type(type), value(std::move(value)), decoded(std::move(decoded)) {}
 
-        [[nodiscard]] string to_string() const final;
+        [[nodiscard]] const EvalResult& get_value() const {
+            return decoded;
+        }
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
+        [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     enum class Operator : ubyte {
@@ -152,165 +215,201 @@ namespace lox::ast {
     Operator get_op_from_token(TokenType tp);
 
     class AbstractBinaryExpr : public Expr {
+        friend class lox::optimizer::Optimizer;
+
     protected:
-        shared_ptr<Expr> left, right;
+        Expr *left, *right;
         Operator op;
 
     public:
-        AbstractBinaryExpr(shared_ptr<Expr> left, Operator op, shared_ptr<Expr> right)
-                : left(std::move(left)), op(op), right(std::move(right)) {}
+        AbstractBinaryExpr(ExprKind kind, Expr* left, Operator op, Expr* right)
+                : Expr(kind), left(left), op(op), right(right) {}
 
-        [[nodiscard]] shared_ptr<Expr> get_left() const {
+        [[nodiscard]] Expr* get_left() const {
             return left;
         }
 
-        [[nodiscard]] shared_ptr<Expr> get_right() const {
+        [[nodiscard]] Expr* get_right() const {
             return right;
         }
 
+        [[nodiscard]] Operator get_op() const {
+            return op;
+        }
+
         [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) override = 0;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) override = 0;
+    };
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) override = 0;
+    // Specialised form a binary expression rewrites itself to once it has seen the types of its operands.
+    // Each specialised form checks that the operands still have the expected types before taking its fast path.
+    enum class Quickening : ubyte {
+        UNOBSERVED,  // Not evaluated yet.
+        GENERIC,     // Operand types vary, or have no fast path: always check every combination.
+        ADD_NUM_NUM,
+        SUB_NUM_NUM,
+        MUL_NUM_NUM,
+        DIV_NUM_NUM,
+        LESS_NUM_NUM,
+        GREATER_NUM_NUM,
+        LESS_EQUAL_NUM_NUM,
+        GREATER_EQUAL_NUM_NUM,
+        EQUAL_NUM_NUM,
+        NOT_EQUAL_NUM_NUM,
+        ADD_STR_STR
     };
 
     class BinaryExpr : public AbstractBinaryExpr {
-    public:
-        BinaryExpr(shared_ptr<Expr> left, Operator op, shared_ptr<Expr> right)
-                : AbstractBinaryExpr(std::move(left), op, std::move(right)) {}
+        Quickening quickening = Quickening::UNOBSERVED;
+
+        void quicken(const EvalResult& left_result, const EvalResult& right_result);
+
+        [[nodiscard]] EvalResult evaluate_generic(const EvalResult& left_result, const EvalResult& right_result) const;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
+    public:
+        BinaryExpr(Expr* left, Operator op, Expr* right)
+                : AbstractBinaryExpr(ExprKind::BINARY, left, op, right) {}
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     class GroupExpr : public Expr {
     public:
-        shared_ptr<Expr> expr;
+        Expr* expr;
 
-        explicit GroupExpr(shared_ptr<Expr> expression) : expr(std::move(expression)) {}
+        explicit GroupExpr(Expr* expression) : Expr(ExprKind::GROUP), expr(expression) {}
 
         [[nodiscard]] string to_string() const final {
             return "(group " + expr->to_string() + ")";
         }
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final {
-            return expr->evaluate(env);
-        };
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final {
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final {
             return expr->evaluate(interpreter);
         }
     };
 
     class UnaryExpr : public Expr {
+        friend class lox::optimizer::Optimizer;
+
         Operator op;
-        shared_ptr<Expr> operand;
+        Expr* operand;
     public:
-        UnaryExpr(Operator operat, shared_ptr<Expr> expression) : op(operat), operand(std::move(expression)) {}
+        UnaryExpr(Operator operat, Expr* expression) : Expr(ExprKind::UNARY), op(operat), operand(expression) {}
 
-        [[nodiscard]] shared_ptr<Expr> get_operand() const {
+        [[nodiscard]] Expr* get_operand() const {
             return operand;
         }
 
-        [[nodiscard]] string to_string() const final;
+        [[nodiscard]] Operator get_op() const {
+            return op;
+        }
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
+        [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     class AbstractVarExpr : public Expr {
     protected:
         string name;
+        VarLocation location;  // Filled in by the resolver. Unresolved names are globals.
 
     public:
-        explicit AbstractVarExpr(const string &name) : name(name) {};
+        AbstractVarExpr(ExprKind kind, const string &name) : Expr(kind), name(name), location(global_location(name)) {};
 
         [[nodiscard]] string get_name() const {
             return name;
         };
 
-        [[nodiscard]] string to_string() const final {
+        void set_location(const VarLocation& loc) {
+            location = loc;
+        }
+
+        [[nodiscard]] string to_string() const override {
             return name;
         };
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) override = 0;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) override = 0;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) override = 0;
     };
 
     class VariableExpr : public AbstractVarExpr {
     public:
         explicit VariableExpr(const Token &id_token);
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     class AssignmentExpr : public AbstractVarExpr {
-        shared_ptr<Expr> value;
+        friend class lox::optimizer::Optimizer;
+
+        Expr* value;
 
     public:
-        AssignmentExpr(const string& name, shared_ptr<Expr> value);
+        AssignmentExpr(const string& name, Expr* value);
 
-        [[nodiscard]] shared_ptr<Expr> get_value() const {
+        [[nodiscard]] Expr* get_value() const {
             return value;
         };
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
+        [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     class LogicalExpr : public AbstractBinaryExpr {
     public:
-        LogicalExpr(shared_ptr<Expr> left, Operator op, shared_ptr<Expr> right)
-                : AbstractBinaryExpr(std::move(left), op, std::move(right)) {
+        LogicalExpr(Expr* left, Operator op, Expr* right)
+                : AbstractBinaryExpr(ExprKind::LOGICAL, left, op, right) {
             if (op != Operator::AND && op != Operator::OR) {
                 throw invalid_argument("Logical expressions cannot be constructed with non-logical operators.");
             }
         }
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
+    class GetAttrExpr;
+    class SuperExpr;
+
     class CallExpr : public Expr {
-        shared_ptr<Expr> callee;
-        vector<shared_ptr<Expr>> args;
+        friend class lox::optimizer::Optimizer;
+
+        Expr* callee;
+        vector<Expr*> args;
+        // Set when the callee is a method access, which can then be called without binding the method first.
+        GetAttrExpr* attr_callee;
+        SuperExpr* super_callee;
 
     public:
-        CallExpr(const shared_ptr<Expr> &callee, const vector<shared_ptr<Expr>> &args);
+        CallExpr(Expr* callee, const vector<Expr*> &args);
 
-        [[nodiscard]] shared_ptr<Expr> get_callee() const {
+        [[nodiscard]] Expr* get_callee() const {
             return callee;
         }
 
-        [[nodiscard]] vector<shared_ptr<Expr>> get_args() const {
+        [[nodiscard]] vector<Expr*> get_args() const {
             return args;
         }
 
         [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     class AbstractInstAccessExpr : public Expr {
+        friend class lox::optimizer::Optimizer;
+
     protected:
-        shared_ptr<Expr> obj;
+        Expr* obj;
         Token attr_token;
         string attr_name;
+        SymbolId attr_id;
 
     public:
-        explicit AbstractInstAccessExpr(const shared_ptr<Expr> &target, const Token &attr);
+        AbstractInstAccessExpr(ExprKind kind, Expr* target, const Token &attr);
 
-        [[nodiscard]] shared_ptr<Expr> get_obj() const {
+        [[nodiscard]] Expr* get_obj() const {
             return obj;
         }
 
@@ -324,128 +423,189 @@ namespace lox::ast {
 
         [[nodiscard]] string to_string() const override;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) override = 0;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) override = 0;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) override = 0;
     };
 
     class GetAttrExpr : public AbstractInstAccessExpr {
+        PropertyCache cache;
+
     public:
-        explicit GetAttrExpr(const shared_ptr<Expr> &target, const Token &attr);
+        explicit GetAttrExpr(Expr* target, const Token &attr);
 
         [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        // Used when this expression is being called. Methods are returned without being bound,
+        // and 'receiver' is set to the instance they must be invoked on.
+        [[nodiscard]] EvalResult evaluate_unbound(Interpreter& interpreter, InstancePtr &receiver);
     };
 
     class SetAttrExpr : public AbstractInstAccessExpr {
-        shared_ptr<Expr> value;
+        friend class lox::optimizer::Optimizer;
+
+        Expr* value;
+        PropertyCache cache;
 
     public:
-        explicit SetAttrExpr(const shared_ptr<Expr> &target, const Token &attr, const shared_ptr<Expr> &value);
+        explicit SetAttrExpr(Expr* target, const Token &attr, Expr* value);
 
-        [[nodiscard]] shared_ptr<Expr> get_value() const {
+        [[nodiscard]] Expr* get_value() const {
             return value;
         }
 
         [[nodiscard]] string to_string() const final;
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
     class ThisExpr : public Expr {
         Token kw;
+        VarLocation location;
 
     public:
-        explicit ThisExpr(const Token &token) : kw(token) {}
+        explicit ThisExpr(const Token &token) : Expr(ExprKind::THIS), kw(token) {}
+
+        void set_location(const VarLocation& loc) {
+            location = loc;
+        }
 
         [[nodiscard]] string to_string() const final {
             return "this";
         }
 
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment> &env) final;
-
-        [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter> &interpreter) final;
+        [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
     };
 
-    class SuperExpr;
-}
-
-namespace lox::interpreter::for_ast{
-    size_t get_super_dist(const shared_ptr<Interpreter>& interpreter, const shared_ptr<ast::SuperExpr>& expr);
-}
-
-namespace lox::ast{
-    using lox::interpreter::for_ast::get_super_dist;
-
     class SuperExpr: public Expr{
         Token kw, meth;
+        SymbolId meth_id;
+        VarLocation location, this_location;  // Locations of 'super' and of the instance the method runs on.
 
         public:
             explicit SuperExpr(const Token& kw, const Token& meth);
 
+            void set_location(const VarLocation& loc){
+                location = loc;
+            }
+
+            void set_this_location(const VarLocation& loc){
+                this_location = loc;
+            }
+
+            [[nodiscard]] string get_meth_name() const{
+                return meth.get_lexeme();
+            }
+
             [[nodiscard]] string to_string() const final{
                 return "super";
             }
 
-            [[nodiscard]] EvalResult evaluate(const shared_ptr<Environment>& env) final;
-            [[nodiscard]] EvalResult evaluate(const shared_ptr<Interpreter>& interpreter) final;
+            [[nodiscard]] EvalResult evaluate(Interpreter& interpreter) final;
+
+            // Same as GetAttrExpr::evaluate_unbound.
+            [[nodiscard]] EvalResult evaluate_unbound(Interpreter& interpreter, InstancePtr& receiver);
     };
     // endregion
 
+    // How a statement finished executing.
+    // A return statement hands back its value this way, and every enclosing block, loop or branch stops and
+    // passes it on until it reaches the function body, so returning costs no more than a branch.
+    struct Completion{
+        bool is_return = false;
+        EvalResult value;
+
+        [[nodiscard]] static Completion normal(){
+            return {};
+        }
+
+        [[nodiscard]] static Completion returned(EvalResult value){
+            return {true, std::move(value)};
+        }
+    };
+
+    // Concrete type of a statement node. See ExprKind.
+    enum class StmtKind: ubyte{
+        EXPR,
+        PRINT,
+        VARIABLE,
+        BLOCK,
+        IF,
+        WHILE,
+        FUNCTION,
+        RETURN,
+        CLASS
+    };
+
     // Base class for statements. A statement is an instruction executed by the interpreter.
-    class Statement: public enable_shared_from_this<Statement>{
+    class Statement{
+        StmtKind kind;
+
+        protected:
+            explicit Statement(StmtKind kind): kind(kind){}
+
         public:
             virtual ~Statement() = default;
-            virtual void execute(const shared_ptr<Environment>& env) = 0;
-            virtual void execute(const shared_ptr<Interpreter>& interpreter) = 0;
+
+            [[nodiscard]] StmtKind get_kind() const{
+                return kind;
+            }
+
+            // Displays the statement and the statements it contains in the same notation as expressions.
+            [[nodiscard]] virtual string to_string() const = 0;
+
+            virtual Completion execute(Interpreter& interpreter) = 0;
     };
 
     class StatementWithExpr: public Statement{
+        friend class lox::optimizer::Optimizer;
+
         protected:
-            shared_ptr<Expr> expr;
+            Expr* expr;
         public:
-            explicit StatementWithExpr(shared_ptr<Expr> expr): expr(std::move(expr)){}
+            StatementWithExpr(StmtKind kind, Expr* expr): Statement(kind), expr(expr){}
 
-            [[nodiscard]] shared_ptr<Expr> get_expr() const{
+            [[nodiscard]] Expr* get_expr() const{
                 return expr;
             }
 
-            void execute(const shared_ptr<Environment>& env) override = 0;
-            void execute(const shared_ptr<Interpreter>& interpreter) override = 0;
+            Completion execute(Interpreter& interpreter) override = 0;
     };
 
     class ExprStatement: public StatementWithExpr{
         public:
-            explicit ExprStatement(shared_ptr<Expr> expr): StatementWithExpr(std::move(expr)){}
+            explicit ExprStatement(Expr* expr): StatementWithExpr(StmtKind::EXPR, expr){}
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class PrintStatement: public StatementWithExpr{
         public:
-            explicit PrintStatement(shared_ptr<Expr> expr): StatementWithExpr(std::move(expr)){}
+            explicit PrintStatement(Expr* expr): StatementWithExpr(StmtKind::PRINT, expr){}
+
+            [[nodiscard]] string to_string() const final;
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class VariableStatement: public StatementWithExpr{
         string name;
+        VarLocation location;  // Slot of the declared variable, filled in by the resolver.
 
         public:
-            explicit VariableStatement(const string& name, shared_ptr<Expr> init_expr);
+            explicit VariableStatement(const string& name, Expr* init_expr);
 
             [[nodiscard]] string get_name() const{
                 return name;
             }
 
-            [[nodiscard]] shared_ptr<Expr> get_initialiser() const{
+            void set_location(const VarLocation& loc){
+                location = loc;
+            }
+
+            [[nodiscard]] Expr* get_initialiser() const{
                 return expr;
             }
 
@@ -453,93 +613,130 @@ namespace lox::ast{
                 return (expr != nullptr);
             }
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class BlockStatement: public Statement{
-        vector<shared_ptr<Statement>> statements;
+        friend class lox::optimizer::Optimizer;
+
+        vector<Statement*> statements;
+        // Filled in by the resolver: frame slot of the block's first variable, and whether closures capture any of them.
+        size_t first_slot = 0;
+        bool closes_upvalues = true;
 
         public:
-            explicit BlockStatement(vector<shared_ptr<Statement>> statements);
+            explicit BlockStatement(vector<Statement*> statements);
 
-            [[nodiscard]] vector<shared_ptr<Statement>> get_stmts() const{
+            [[nodiscard]] vector<Statement*> get_stmts() const{
                 return statements;
             }
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            void set_first_slot(size_t slot){
+                first_slot = slot;
+            }
+
+            void set_closes_upvalues(bool value){
+                closes_upvalues = value;
+            }
+
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class AbstractLogicalStmt: public Statement{
+        friend class lox::optimizer::Optimizer;
+
         protected:
-            shared_ptr<Expr> condition;
-            shared_ptr<Statement> on_success;
+            Expr* condition;
+            Statement* on_success;
 
         public:
-            AbstractLogicalStmt(shared_ptr<Expr> condition, shared_ptr<Statement> success);
+            AbstractLogicalStmt(StmtKind kind, Expr* condition, Statement* success);
 
-            [[nodiscard]] shared_ptr<Expr> get_condition() const{
+            [[nodiscard]] Expr* get_condition() const{
                 return condition;
             }
 
-            [[nodiscard]] shared_ptr<Statement> get_success() const{
+            [[nodiscard]] Statement* get_success() const{
                 return on_success;
             }
 
-            void execute(const shared_ptr<Environment>& env) override = 0;
-            void execute(const shared_ptr<Interpreter>& interpreter) override = 0;
+            Completion execute(Interpreter& interpreter) override = 0;
     };
 
     class IfStatement: public AbstractLogicalStmt{
-        shared_ptr<Statement> on_failure;
+        friend class lox::optimizer::Optimizer;
+
+        Statement* on_failure;
 
         public:
-            IfStatement(shared_ptr<Expr> condition, shared_ptr<Statement> success, shared_ptr<Statement> failure);
-            IfStatement(shared_ptr<Expr> condition, shared_ptr<Statement> success);
+            IfStatement(Expr* condition, Statement* success, Statement* failure);
+            IfStatement(Expr* condition, Statement* success);
 
             [[nodiscard]] bool has_failure() const{
                 return (on_failure != nullptr);
             }
 
-            [[nodiscard]] shared_ptr<Statement> get_failure() const{
+            [[nodiscard]] Statement* get_failure() const{
                 return on_failure;
             }
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class WhileStatement: public AbstractLogicalStmt{
         public:
-            WhileStatement(shared_ptr<Expr> condition, shared_ptr<Statement> success);
+            WhileStatement(Expr* condition, Statement* success);
+
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
+    };
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+    // Where a closure finds a variable it captures when it is created:
+    // either a slot of the enclosing function's frame, or one of the enclosing function's own upvalues.
+    struct UpvalueRef{
+        size_t index;
+        bool is_local;
     };
 
     class FunctionStmt: public Statement{
         string name;
         vector<Token> args;
-        vector<shared_ptr<Statement>> body;
-
-        friend EvalResult for_callable::exec_func_body(const shared_ptr<Environment>& env, const shared_ptr<Statement>& func_stmt);
-        friend EvalResult for_callable::exec_func_body(const shared_ptr<Interpreter>& interpreter, const shared_ptr<Statement>& func_stmt);
-        friend vector<Token> for_callable::get_args(const shared_ptr<Statement>& func_stmt);
-        friend string for_callable::get_func_name(const shared_ptr<Statement>& func_stmt);
+        vector<Statement*> body;
+        VarLocation location;
+        // Filled in by the resolver: every variable of the function lives in a call frame of 'frame_size' slots,
+        // and the ones it uses from enclosing functions are captured as upvalues.
+        size_t frame_size = 0;
+        vector<UpvalueRef> upvalues;
+
+        friend EvalResult for_callable::exec_func_body(Interpreter& interpreter, Statement* func_stmt);
+        friend vector<Token> for_callable::get_args(Statement* func_stmt);
+        friend string for_callable::get_func_name(Statement* func_stmt);
+        friend size_t for_callable::get_frame_size(Statement* func_stmt);
+        friend class lox::optimizer::Optimizer;
 
         public:
-            FunctionStmt(const Token& id_token, const vector<Token>& args, const vector<shared_ptr<Statement>>& body);
+            FunctionStmt(const Token& id_token, const vector<Token>& args, const vector<Statement*>& body);
 
             [[nodiscard]] string get_name() const{
                 return name;
             }
 
+            void set_location(const VarLocation& loc){
+                location = loc;
+            }
+
             [[nodiscard]] vector<Token> get_args() const{
                 return args;
             }
 
-            [[nodiscard]] vector<shared_ptr<Statement>> get_body() const{
+            [[nodiscard]] vector<Statement*> get_body() const{
                 return body;
             }
 
@@ -547,60 +744,90 @@ namespace lox::ast{
                 return static_cast<ubyte>(args.size());
             }
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            void set_frame(size_t size, vector<UpvalueRef> captured){
+                frame_size = size;
+                upvalues = std::move(captured);
+            }
+
+            [[nodiscard]] const vector<UpvalueRef>& get_upvalues() const{
+                return upvalues;
+            }
+
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class ReturnStmt: public StatementWithExpr{
         public:
-            explicit ReturnStmt(const shared_ptr<Expr>& expr): StatementWithExpr(expr){}
+            explicit ReturnStmt(Expr* expr): StatementWithExpr(StmtKind::RETURN, expr){}
 
             [[nodiscard]] bool has_val() const{
                 return (expr != nullptr);
             }
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     class ClassStmt: public Statement{
         string name;
-        shared_ptr<VariableExpr> super_cls;
-        vector<shared_ptr<FunctionStmt>> methods;
+        VariableExpr* super_cls;
+        vector<FunctionStmt*> methods;
+        VarLocation location, super_location;  // The superclass is kept in a frame slot for the methods to capture.
+        bool super_captured = true;
+
+        [[nodiscard]] CallablePtr make_class(Interpreter& interpreter, const EvalResult& superclass) const;
 
         public:
-            explicit ClassStmt(const Token& id_token, const shared_ptr<VariableExpr>& superclass, const vector<shared_ptr<FunctionStmt>>& meths);
+            explicit ClassStmt(const Token& id_token, VariableExpr* superclass, const vector<FunctionStmt*>& meths);
 
             [[nodiscard]] string get_name() const{
                 return name;
             }
 
+            void set_location(const VarLocation& loc){
+                location = loc;
+            }
+
+            void set_super_location(const VarLocation& loc){
+                super_location = loc;
+            }
+
+            void set_super_captured(bool value){
+                super_captured = value;
+            }
+
             [[nodiscard]] bool has_superclass() const{
                 return super_cls != nullptr;
             }
 
-            [[nodiscard]] shared_ptr<VariableExpr> get_superclass() const{
+            [[nodiscard]] VariableExpr* get_superclass() const{
                 return super_cls;
             }
 
-            [[nodiscard]] vector<shared_ptr<FunctionStmt>> get_meths() const{
+            [[nodiscard]] vector<FunctionStmt*> get_meths() const{
                 return methods;
             }
 
-            void execute(const shared_ptr<Environment>& env) final;
-            void execute(const shared_ptr<Interpreter>& interpreter) final;
+            [[nodiscard]] string to_string() const final;
+
+            Completion execute(Interpreter& interpreter) final;
     };
 
     // Functions only used in callable context. Must not be used elsewhere.
     namespace for_callable{
 
-        EvalResult exec_func_body(const shared_ptr<Interpreter>& interpreter, const shared_ptr<Statement>& func_stmt);
+        EvalResult exec_func_body(Interpreter& interpreter, Statement* func_stmt);
+
+        string get_func_name(Statement* func_stmt);
 
-        string get_func_name(const shared_ptr<Statement>& func_stmt);
+        vector<Token> get_args(Statement* func_stmt);
 
-        vector<Token> get_args(const shared_ptr<Statement>& func_stmt);
+        ubyte get_arg_count(Statement* func_stmt);
 
-        ubyte get_arg_count(const shared_ptr<Statement>& func_stmt);
+        size_t get_frame_size(Statement* func_stmt);
     }
 }
 
@@ -3,85 +3,79 @@
 //
 
 #include "callable.hpp"
+#include "env.hpp"
+#include "gc.hpp"
+#include "instance.hpp"
 
 namespace lox::callable{
-    bool is_number(const Value& val){
-        return holds_alternative<double>(val);
-    }
-
-    bool is_boolean(const Value& val){
-        return holds_alternative<bool>(val);
-    }
-
-    bool is_string(const Value& val){
-        return holds_alternative<string>(val);
-    }
-
-    bool is_callable(const Value& val){
-        return holds_alternative<CallablePtr>(val);
-    }
-
-    bool is_cls_inst(const Value& val){
-        return holds_alternative<InstancePtr>(val);
-    }
-
     // region LoxFunction
-    LoxFunction::LoxFunction(const shared_ptr<ast::Statement>& decl,const shared_ptr<Environment>& closure, bool is_initialiser)
-    : AbstractLoxCallable(), decl(decl), closure(closure), is_init(is_initialiser){
-        child_env = get_child_env(closure);
-    }
+    LoxFunction::LoxFunction(ast::Statement* decl, vector<Ref<Upvalue>> upvalues, bool is_initialiser, bool is_method, const InstancePtr& receiver)
+    : AbstractLoxCallable(CallableKind::FUNCTION), decl(decl), upvalues(std::move(upvalues)), receiver(receiver), frame_size(get_frame_size(decl)),
+    is_init(is_initialiser), is_method(is_method){}
 
-    shared_ptr<LoxFunction> LoxFunction::bind(const InstancePtr& inst){
-        auto bound_closure = get_child_env(closure);
-        set_env_member(bound_closure, "this", inst);
-        return make_shared<LoxFunction>(decl, bound_closure, is_init);
+    CallablePtr LoxFunction::bind(const InstancePtr& inst){
+        return make_obj<LoxFunction>(decl, upvalues, is_init, is_method, inst);
     }
 
-    constexpr ubyte LoxFunction::arity() const{
+    ubyte LoxFunction::arity() const{
         return get_arg_count(decl);
     }
 
-    Value LoxFunction::call(const shared_ptr<Environment>& env, const vector<Value>& args){
-        vector<Token> decl_args = get_args(decl);
+    Value LoxFunction::call(Interpreter& interpreter, const vector<Value>& args){
+        return invoke(interpreter, receiver, args);
+    }
 
-        for (ubyte i = 0; i < get_arg_count(decl); ++i){
-            set_env_member(child_env, decl_args.at(i).get_lexeme(), args.at(i));
+    // Runs the call in its own slots of the interpreter's frame stack. The resolver gives parameters the first slots,
+    // in declaration order, right after 'this' for methods.
+    // Throws a runtime_error when the native stack runs low, which happens with runaway recursion.
+    Value LoxFunction::invoke(Interpreter& interpreter, const InstancePtr& inst, const vector<Value>& args){
+        lox::gc::Heap::get().collect_if_needed();
+        size_t previous_base = push_frame(interpreter, frame_size);
+        size_t first_arg_slot = 0;
+        if (is_method){
+            set_frame_slot(interpreter, 0, inst);
+            first_arg_slot = 1;
+        }
+        for (size_t i = 0; i < args.size(); ++i){
+            set_frame_slot(interpreter, first_arg_slot + i, args[i]);
         }
 
-        Value ret_val = exec_func_body(child_env, decl);
+        auto previous_upvalues = set_upvalues(interpreter, &upvalues);
+        Value ret_val = exec_func_body(interpreter, decl);
+        set_upvalues(interpreter, previous_upvalues);
+        pop_frame(interpreter, previous_base);
         if (is_init){
-            return value_of_this(closure);
+            return inst;
         }
 
         return ret_val;
     }
 
-    Value LoxFunction::call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args){
-        prev_children.push(child_env);
-        child_env = get_child_env(closure);
-        vector<Token> decl_args = get_args(decl);
-
-        for (ubyte i = 0; i < get_arg_count(decl); ++i){
-            set_env_member(child_env, decl_args.at(i).get_lexeme(), args.at(i));
-        }
-
-        set_current_env(interpreter, child_env);
-        Value ret_val = exec_func_body(interpreter, decl);
-        return_to_previous_env(interpreter);
-        child_env = prev_children.top();
-        prev_children.pop();
-        if (is_init){
-            return value_of_this(closure);
+    void LoxFunction::trace(Tracer& tracer) const{
+        for (const auto& upvalue: upvalues){
+            tracer.visit(upvalue);
         }
+        tracer.visit(receiver);
+    }
 
-        return ret_val;
+    void LoxFunction::clear_refs(){
+        upvalues.clear();
+        receiver = nullptr;
     }
     // endregion
 
     // region LoxClass
-    LoxClass::LoxClass(const string& cls_name, const shared_ptr<LoxClass>& superclass, const MethodMap& meths)
-    : name(cls_name), superclass(superclass), methods(meths){
-        auto initialiser = find_meth("init");
+    LoxClass::LoxClass(const string& cls_name, const Ref<LoxClass>& superclass, const MethodMap& meths)
+    : AbstractLoxCallable(CallableKind::CLASS), name(cls_name), superclass(superclass){
+        // Copy the inherited methods down, then let the class's own methods override them.
+        if (superclass != nullptr){
+            methods = superclass->methods;
+        }
+        for (const auto& [meth_name, meth]: meths){
+            methods.insert_or_assign(lox::symbols::intern(meth_name), meth);
+        }
+
+        initialiser = find_meth("init");
         if (initialiser != nullptr){
             init_arity = initialiser->arity();
         }
@@ -90,82 +84,65 @@ namespace lox::callable{
         }
     }
 
-    shared_ptr<LoxFunction> LoxClass::find_meth(const string& meth_name){
-        if (methods.contains(meth_name)){
-            return methods.at(meth_name);
+    CallablePtr LoxClass::find_meth(SymbolId meth_id) const{
+        auto found = methods.find(meth_id);
+        if (found == methods.end()){
+            return nullptr;
         }
+        return found->second;
+    }
 
-        if (superclass != nullptr)
-            return superclass->find_meth(meth_name);
-
-        return nullptr;
+    CallablePtr LoxClass::find_meth(const string& meth_name) const{
+        return find_meth(lox::symbols::intern(meth_name));
     }
 
-    constexpr ubyte LoxClass::arity() const{
+    ubyte LoxClass::arity() const{
         return init_arity;
     }
 
-    Value LoxClass::call(const shared_ptr<Environment>& env, const vector<Value>& args){
-        auto shared = dynamic_pointer_cast<LoxClass>(shared_from_this());
+    Value LoxClass::call(Interpreter& interpreter, const vector<Value>& args){
+        auto shared = Ref<LoxClass>(this);
         auto inst = create_inst(shared);
-        shared_ptr<LoxFunction> initialiser = find_meth("init");
         if (initialiser != nullptr){
-            VarValue val = initialiser->bind(inst)->call(env, args);
+            VarValue val = initialiser->invoke(interpreter, inst, args);
         }
         return inst;
     }
 
-    Value LoxClass::call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args){
-        auto shared = dynamic_pointer_cast<LoxClass>(shared_from_this());
-        auto inst = create_inst(shared);
-        shared_ptr<LoxFunction> initialiser = find_meth("init");
-        if (initialiser != nullptr){
-            VarValue val = initialiser->bind(inst)->call(interpreter, args);
+    void LoxClass::trace(Tracer& tracer) const{
+        tracer.visit(superclass);
+        for (const auto& [meth_id, meth]: methods){
+            tracer.visit(meth);
         }
-        return inst;
+        tracer.visit(initialiser);
     }
 
+    void LoxClass::clear_refs(){
+        superclass = nullptr;
+        methods.clear();
+        initialiser = nullptr;
+    }
     // endregion
 
     namespace builtins{
-        Value ClockFunc::call(const shared_ptr<Environment>& interpreter, const vector<Value>& args){
+        Value ClockFunc::call_native(const vector<Value>&){
             return (double)time(nullptr);
         }
 
-        Value ClockFunc::call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args){
-            return (double)time(nullptr);
-        }
-
-        Value SinFunc::call(const shared_ptr<Environment>& env, const vector<Value>& args){
-            EvalResult nb = args.at(0);
-            if (!is_number(nb)){
-                throw runtime_error("A number is needed when calling sin.");
-            }
-            return sin(get<double>(nb));
-        }
-
-        Value SinFunc::call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args){
+        Value SinFunc::call_native(const vector<Value>& args){
             EvalResult nb = args.at(0);
             if (!is_number(nb)){
                 throw runtime_error("A number is needed when calling sin.");
             }
-            return sin(get<double>(nb));
-        }
-
-        Value CosFunc::call(const shared_ptr<Environment>& env, const vector<Value>& args){
-            EvalResult nb = args.at(0);
-            if (!is_number(nb)){
-                throw runtime_error("A number is needed when calling cos.");
-            }
-            return cos(get<double>(nb));
+            return sin(nb.as_number());
         }
 
-        Value CosFunc::call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args){
+        Value CosFunc::call_native(const vector<Value>& args){
             EvalResult nb = args.at(0);
             if (!is_number(nb)){
                 throw runtime_error("A number is needed when calling cos.");
             }
-            return cos(get<double>(nb));
+            return cos(nb.as_number());
         }
     }
-}
\ No newline at end of file
+}
@@ -7,23 +7,27 @@
 #include <cstdint>
 #include <ctime>
 #include <memory>
-#include <stack>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include "utils.hpp"
 #include "tokenizer.hpp"
+#include "shape.hpp"
+#include "symbols.hpp"
+#include "value.hpp"
 
 // Forward declarations (part 1)
 namespace lox::env{
     using std::shared_ptr;
 
     class Environment;
+    class Upvalue;
 }
 
 namespace lox::ast{
     using lox::env::Environment;
     using lox::tokenizer::token::Token;
+    using lox::value::Ref;
     using std::shared_ptr;
     using std::string;
 
@@ -31,11 +35,13 @@ namespace lox::ast{
 
     // Functions only used in callable context. Must not be used elsewhere.
     namespace for_callable {
-        string get_func_name(const shared_ptr<Statement>& func_stmt);
+        string get_func_name(Statement* func_stmt);
 
-        vector<Token> get_args(const shared_ptr<Statement>& func_stmt);
+        vector<Token> get_args(Statement* func_stmt);
 
-        ubyte get_arg_count(const shared_ptr<Statement>& func_stmt);
+        ubyte get_arg_count(Statement* func_stmt);
+
+        size_t get_frame_size(Statement* func_stmt);
     }
 }
 
@@ -47,20 +53,19 @@ namespace lox::inst{
 
 namespace lox::interpreter{
     using lox::env::Environment;
+    using lox::value::Ref;
     using std::shared_ptr;
 
     class Interpreter;
 
     namespace for_ast{
-        shared_ptr<Environment> get_current_env(const shared_ptr<Interpreter>& interpreter);
-
-        void set_current_env(const shared_ptr<Interpreter>& interpreter, const shared_ptr<Environment>& env);
+        size_t push_frame(Interpreter& interpreter, size_t size);
 
-        void return_to_previous_env(const shared_ptr<Interpreter>& interpreter);
+        void pop_frame(Interpreter& interpreter, size_t previous_base);
 
-        void add_nesting_level(const shared_ptr<Interpreter>& interpreter);
+        void set_frame_slot(Interpreter& interpreter, size_t slot, lox::value::Value value);
 
-        void remove_nesting_level(const shared_ptr<Interpreter>& interpreter);
+        const std::vector<Ref<lox::env::Upvalue>>* set_upvalues(Interpreter& interpreter, const std::vector<Ref<lox::env::Upvalue>>* upvalues);
     }
 }
 
@@ -74,40 +79,75 @@ namespace lox::callable {
 
     using lox::interpreter::Interpreter;
     using lox::tokenizer::token::Token;
+    using lox::value::make_obj;
+    using lox::value::Obj;
+    using lox::value::ObjType;
+    using lox::value::Ref;
+    using lox::value::static_obj_cast;
+    using lox::shape::Shape;
+    using lox::symbols::SymbolId;
+    using lox::value::Tracer;
 
     using std::cos;
-    using std::dynamic_pointer_cast;
-    using std::enable_shared_from_this;
     using std::make_shared;
     using std::runtime_error;
     using std::shared_ptr;
     using std::sin;
-    using std::stack;
     using std::string;
     using std::time;
     using std::time_t;
 
     class AbstractLoxCallable;
 
-    using CallablePtr = shared_ptr<AbstractLoxCallable>;
-    using InstancePtr = shared_ptr<LoxInstance>;
+    using CallablePtr = Ref<AbstractLoxCallable>;
+    using InstancePtr = Ref<LoxInstance>;
 
-    using Value = variant<double, bool, string, CallablePtr, InstancePtr>;
+    using Value = lox::value::Value;
     using VarValue = Value;
     using EvalResult = Value;
 
-    class AbstractLoxCallable: public enable_shared_from_this<AbstractLoxCallable>{
+    // Concrete type of a callable, so that engines can switch on it when calling instead of casting.
+    enum class CallableKind: ubyte{
+        FUNCTION,         // Function or method run by the tree-walking engine.
+        CLASS,
+        NATIVE,
+        VM_CLOSURE,
+        VM_BOUND_METHOD
+    };
+
+    class AbstractLoxCallable: public Obj{
+        CallableKind kind;
+
+    protected:
+        explicit AbstractLoxCallable(CallableKind kind): Obj(ObjType::CALLABLE), kind(kind){}
+
     public:
-        virtual ~AbstractLoxCallable() = default;
+        [[nodiscard]] CallableKind get_kind() const{
+            return kind;
+        }
 
         [[nodiscard]] virtual string to_string() const = 0;
 
         [[nodiscard]] virtual constexpr ubyte arity() const = 0;
 
-        [[nodiscard]] virtual Value call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args) = 0;
-        [[nodiscard]] virtual Value call(const shared_ptr<Environment>& env, const vector<Value>& args) = 0;
+        // Returns a version of this callable with 'this' bound to the given instance.
+        // Callables that cannot be used as methods are returned as-is.
+        [[nodiscard]] virtual CallablePtr bind(const InstancePtr&){
+            return CallablePtr(this);
+        }
+
+        [[nodiscard]] virtual Value call(Interpreter& interpreter, const vector<Value>& args) = 0;
+
+        // Calls this callable as a method of the given instance. Same as binding it first, but callables which can
+        // take the instance directly override this to avoid creating a bound method on every call.
+        [[nodiscard]] virtual Value invoke(Interpreter& interpreter, const InstancePtr& inst, const vector<Value>& args){
+            return bind(inst)->call(interpreter, args);
+        }
     };
+}
 
+inline lox::value::Ref<lox::callable::AbstractLoxCallable> lox::value::Value::as_callable() const{
+    return Ref<AbstractLoxCallable>(static_cast<AbstractLoxCallable*>(as_obj()));
 }
 
 // Forward declarations (part 2)
@@ -115,58 +155,60 @@ namespace lox::ast::for_callable{
     using lox::callable::EvalResult;
     using lox::interpreter::Interpreter;
 
-    EvalResult exec_func_body(const shared_ptr<Interpreter>& interpreter, const shared_ptr<Statement>& func_stmt);
-    EvalResult exec_func_body(const shared_ptr<Environment>& env, const shared_ptr<Statement>& func_stmt);
-}
-
-// Putting this here because we need VarValue from lox::callable for future accesses to the environment to work.
-namespace lox::env::for_callable{
-    using lox::callable::VarValue;
-
-    shared_ptr<Environment> get_child_env(const shared_ptr<Environment>& orig);
-
-    VarValue value_of_this(const shared_ptr<Environment>& orig);
-
-    void set_env_member(const shared_ptr<Environment>& func_env, const string& name, VarValue value);
+    EvalResult exec_func_body(Interpreter& interpreter, Statement* func_stmt);
 }
 
 // Actual file declarations (part 2)
 namespace lox::callable {
     using lox::ast::for_callable::exec_func_body;
-    using lox::env::for_callable::get_child_env;
-    using lox::env::for_callable::set_env_member;
-    using lox::env::for_callable::value_of_this;
+    using lox::env::Upvalue;
 
-    bool is_number(const Value &val);
+    inline bool is_number(const Value &val){
+        return val.is_number();
+    }
 
-    bool is_boolean(const Value &val);
+    inline bool is_boolean(const Value &val){
+        return val.is_bool();
+    }
 
-    bool is_string(const Value &val);
+    inline bool is_string(const Value &val){
+        return val.is_string();
+    }
 
-    bool is_callable(const Value &val);
+    inline bool is_callable(const Value &val){
+        return val.is_callable();
+    }
 
-    bool is_cls_inst(const Value &val);
+    inline bool is_cls_inst(const Value &val){
+        return val.is_instance();
+    }
 
     class LoxFunction : public AbstractLoxCallable {
-        shared_ptr<ast::Statement> decl;
-        shared_ptr<Environment> closure, child_env;
-        stack<shared_ptr<Environment>> prev_children;
+        ast::Statement* decl;  // Owned by the syntax tree's arena, which outlives the program's execution.
+        vector<Ref<Upvalue>> upvalues;  // Variables captured from enclosing functions, in the order the resolver listed them.
+        InstancePtr receiver;  // Instance a bound method passes as 'this'.
+        size_t frame_size;
         bool is_init;
+        bool is_method;
 
     public:
-        LoxFunction(const shared_ptr<ast::Statement>& decl, const shared_ptr<Environment>& closure, bool is_initialiser);
+        LoxFunction(ast::Statement* decl, vector<Ref<Upvalue>> upvalues, bool is_initialiser, bool is_method = false, const InstancePtr& receiver = nullptr);
 
         [[nodiscard]] string to_string() const final {
             return "<fn " + get_func_name(decl) + ">";
         }
 
-        shared_ptr<LoxFunction> bind(const InstancePtr& inst);
+        [[nodiscard]] CallablePtr bind(const InstancePtr& inst) final;
+
+        [[nodiscard]] ubyte arity() const final;
+
+        [[nodiscard]] Value call(Interpreter& interpreter, const vector<Value>& args) final;
 
-        [[nodiscard]] constexpr ubyte arity() const final;
+        [[nodiscard]] Value invoke(Interpreter& interpreter, const InstancePtr& inst, const vector<Value>& args) final;
 
-        [[nodiscard]] Value call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args) final;
+        void trace(Tracer& tracer) const final;
 
-        [[nodiscard]] Value call(const shared_ptr<Environment>& env, const vector<Value>& args) final;
+        void clear_refs() final;
     };
 
     class LoxClass;
@@ -176,7 +218,9 @@ namespace lox::callable {
 namespace lox::inst::for_callable{
     using lox::callable::LoxClass;
 
-    shared_ptr<LoxInstance> create_inst(const shared_ptr<LoxClass>& cls);
+    using lox::value::Ref;
+
+    Ref<LoxInstance> create_inst(const Ref<LoxClass>& cls);
 }
 
 // Actual file declarations (part 3)
@@ -184,31 +228,62 @@ namespace lox::callable{
     using lox::inst::for_callable::create_inst;
 
     using std::unordered_map;
-    using MethodMap = unordered_map<string, shared_ptr<LoxFunction>>;
+    // Methods are stored as generic callables so that both the tree-walker and the VM can share class objects.
+    using MethodMap = unordered_map<string, CallablePtr>;
 
     class LoxClass: public AbstractLoxCallable{
         string name;
-        shared_ptr<LoxClass> superclass;
-        MethodMap methods;
+        Ref<LoxClass> superclass;
+        // Every method available on instances, including inherited ones, so that lookups never walk up the hierarchy.
+        unordered_map<SymbolId, CallablePtr> methods;
+        CallablePtr initialiser;
         ubyte init_arity;
+        Shape root_shape;  // Shape of the instances of this class which do not have any field yet.
 
         public:
-            explicit LoxClass(const string& cls_name, const shared_ptr<LoxClass>& superclass, const MethodMap& meths);
+            // 'meths' only holds the methods declared by the class itself.
+            explicit LoxClass(const string& cls_name, const Ref<LoxClass>& superclass, const MethodMap& meths);
+
+            [[nodiscard]] CallablePtr find_meth(SymbolId meth_id) const;
 
-            shared_ptr<LoxFunction> find_meth(const string& meth_name);
+            [[nodiscard]] CallablePtr find_meth(const string& meth_name) const;
 
-            [[nodiscard]] constexpr ubyte arity() const final;
+            [[nodiscard]] const CallablePtr& get_initialiser() const{
+                return initialiser;
+            }
+
+            [[nodiscard]] Shape* get_root_shape(){
+                return &root_shape;
+            }
+
+            [[nodiscard]] ubyte arity() const final;
 
             [[nodiscard]] string to_string() const final{
                 return name;
             }
 
-            [[nodiscard]] Value call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args) final;
-            [[nodiscard]] Value call(const shared_ptr<Environment>& env, const vector<Value>& args) final;
+            [[nodiscard]] Value call(Interpreter& interpreter, const vector<Value>& args) final;
+
+            void trace(Tracer& tracer) const final;
+
+            void clear_refs() final;
     };
 
     namespace builtins{
-        class ClockFunc: public AbstractLoxCallable{
+        // Functions implemented by the interpreter itself. They do not depend on the engine running the program,
+        // so the VM calls them directly through call_native.
+        class NativeFunction: public AbstractLoxCallable{
+            public:
+                NativeFunction(): AbstractLoxCallable(CallableKind::NATIVE){}
+
+                [[nodiscard]] virtual Value call_native(const vector<Value>& args) = 0;
+
+                [[nodiscard]] Value call(Interpreter&, const vector<Value>& args) final{
+                    return call_native(args);
+                }
+        };
+
+        class ClockFunc: public NativeFunction{
             public:
                 [[nodiscard]] string to_string() const final{
                     return "<fn clock>";
@@ -218,11 +293,10 @@ namespace lox::callable{
                     return 0;
                 }
 
-                [[nodiscard]] Value call(const shared_ptr<Environment>& env, const vector<Value>& args) final;
-                [[nodiscard]] Value call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args) final;
+                [[nodiscard]] Value call_native(const vector<Value>& args) final;
         };
 
-        class CosFunc: public AbstractLoxCallable{
+        class CosFunc: public NativeFunction{
             public:
                 [[nodiscard]] string to_string() const final{
                     return "<fn cos>";
@@ -232,11 +306,10 @@ namespace lox::callable{
                     return 1;
                 }
 
-                [[nodiscard]] Value call(const shared_ptr<Environment>& env, const vector<Value>& args) final;
-                [[nodiscard]] Value call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args) final;
+                [[nodiscard]] Value call_native(const vector<Value>& args) final;
         };
 
-        class SinFunc: public AbstractLoxCallable{
+        class SinFunc: public NativeFunction{
             public:
                 [[nodiscard]] string to_string() const final{
                     return "<fn sin>";
@@ -246,8 +319,7 @@ namespace lox::callable{
                     return 1;
                 }
 
-                [[nodiscard]] Value call(const shared_ptr<Environment>& env, const vector<Value>& args) final;
-                [[nodiscard]] Value call(const shared_ptr<Interpreter>& interpreter, const vector<Value>& args) final;
+                [[nodiscard]] Value call_native(const vector<Value>& args) final;
         };
     }
 }
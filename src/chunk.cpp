@@ -0,0 +1,30 @@
+#include "chunk.hpp"
+#include "exceptions.hpp"
+
+namespace lox::vm{
+    void Chunk::write_short(uint16_t value){
+        code.push_back(static_cast<ubyte>((value >> 8) & 0xff));
+        code.push_back(static_cast<ubyte>(value & 0xff));
+    }
+
+    void Chunk::patch_short(size_t offset, uint16_t value){
+        code[offset] = static_cast<ubyte>((value >> 8) & 0xff);
+        code[offset + 1] = static_cast<ubyte>(value & 0xff);
+    }
+
+    size_t Chunk::add_constant(const Value& value){
+        if (constants.size() > UINT16_MAX){
+            throw compile_error("Too many constants in one chunk.");
+        }
+        constants.push_back(value);
+        return constants.size() - 1;
+    }
+
+    size_t Chunk::add_function(const shared_ptr<VmFunction>& func){
+        if (functions.size() > UINT16_MAX){
+            throw compile_error("Too many functions in one chunk.");
+        }
+        functions.push_back(func);
+        return functions.size() - 1;
+    }
+}
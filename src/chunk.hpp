@@ -0,0 +1,140 @@
+#pragma once
+#include "callable.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lox::vm{
+    using lox::ubyte;
+    using lox::callable::Value;
+
+    using std::shared_ptr;
+    using std::string;
+    using std::uint16_t;
+    using std::vector;
+
+    // Instructions understood by the VM.
+    // Operands are stored right after their opcode, and 16-bit operands are stored big-endian.
+    enum class OpCode: ubyte{
+        CONSTANT,       // u16 constant index
+        NIL,
+        TRUE,
+        FALSE,
+        POP,
+        GET_LOCAL,      // u8 slot
+        SET_LOCAL,      // u8 slot
+        GET_GLOBAL,     // u16 global index
+        DEFINE_GLOBAL,  // u16 global index
+        SET_GLOBAL,     // u16 global index
+        GET_UPVALUE,    // u8 upvalue index
+        SET_UPVALUE,    // u8 upvalue index
+        GET_PROPERTY,   // u16 symbol of the property name
+        SET_PROPERTY,   // u16 symbol of the property name
+        GET_SUPER,      // u16 symbol of the method name
+        // Callee of an INVOKE. Leaves the receiver and the method, or a callable field and nil, on the stack.
+        GET_METHOD,        // u16 symbol of the property name
+        GET_SUPER_METHOD,  // u16 symbol of the method name
+        EQUAL,
+        NOT_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        LESS,
+        LESS_EQUAL,
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        NOT,
+        NEGATE,
+        PRINT,
+        JUMP,           // u16 forward offset
+        JUMP_IF_FALSE,  // u16 forward offset
+        LOOP,           // u16 backward offset
+        CALL,           // u8 argument count
+        INVOKE,         // u8 argument count
+        CLOSURE,        // u16 function index, then one (is_local, index) byte pair per upvalue
+        CLOSE_UPVALUE,
+        RETURN,
+        CLASS           // u16 constant index of the class name, u8 method count, u8 has superclass
+    };
+
+    class VmFunction;
+
+    // A compiled sequence of instructions, along with the constants and nested functions it refers to.
+    class Chunk{
+        vector<ubyte> code;
+        vector<Value> constants;
+        vector<shared_ptr<VmFunction>> functions;
+
+        public:
+            [[nodiscard]] const vector<ubyte>& get_code() const{
+                return code;
+            }
+
+            [[nodiscard]] size_t size() const{
+                return code.size();
+            }
+
+            [[nodiscard]] const Value& get_constant(size_t idx) const{
+                return constants[idx];
+            }
+
+            [[nodiscard]] const shared_ptr<VmFunction>& get_function(size_t idx) const{
+                return functions[idx];
+            }
+
+            void write(ubyte byte){
+                code.push_back(byte);
+            }
+
+            void write(OpCode op){
+                code.push_back(static_cast<ubyte>(op));
+            }
+
+            void write_short(uint16_t value);
+
+            void patch_short(size_t offset, uint16_t value);
+
+            size_t add_constant(const Value& value);
+
+            size_t add_function(const shared_ptr<VmFunction>& func);
+    };
+
+    // The compiled form of a function declaration (or of the whole script).
+    // Closures created at runtime share a single VmFunction.
+    class VmFunction{
+        string name;
+        ubyte arity;
+        ubyte upvalue_count = 0;
+        Chunk chunk;
+
+        public:
+            VmFunction(const string& name, ubyte arity): name(name), arity(arity){}
+
+            [[nodiscard]] string get_name() const{
+                return name;
+            }
+
+            [[nodiscard]] ubyte get_arity() const{
+                return arity;
+            }
+
+            [[nodiscard]] ubyte get_upvalue_count() const{
+                return upvalue_count;
+            }
+
+            void set_upvalue_count(ubyte count){
+                upvalue_count = count;
+            }
+
+            [[nodiscard]] Chunk& get_chunk(){
+                return chunk;
+            }
+
+            [[nodiscard]] const Chunk& get_chunk() const{
+                return chunk;
+            }
+    };
+}
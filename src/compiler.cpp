@@ -0,0 +1,533 @@
+#include "compiler.hpp"
+
+namespace lox::vm{
+    // region GlobalTable
+    uint16_t GlobalTable::resolve(const string& name){
+        auto found = ids.find(name);
+        if (found != ids.end()){
+            return found->second;
+        }
+        if (names.size() > UINT16_MAX){
+            throw compile_error("Too many global variables.");
+        }
+
+        auto id = static_cast<uint16_t>(names.size());
+        ids.insert({name, id});
+        names.push_back(name);
+        return id;
+    }
+    // endregion
+
+    // region Emission helpers
+    void Compiler::emit(OpCode op){
+        chunk().write(op);
+    }
+
+    void Compiler::emit_with_byte(OpCode op, ubyte operand){
+        chunk().write(op);
+        chunk().write(operand);
+    }
+
+    void Compiler::emit_with_short(OpCode op, uint16_t operand){
+        chunk().write(op);
+        chunk().write_short(operand);
+    }
+
+    void Compiler::emit_constant(const Value& value){
+        emit_with_short(OpCode::CONSTANT, static_cast<uint16_t>(chunk().add_constant(value)));
+    }
+
+    size_t Compiler::emit_jump(OpCode op){
+        emit_with_short(op, UINT16_MAX);  // Placeholder, replaced by patch_jump once the target is known.
+        return chunk().size() - 2;
+    }
+
+    void Compiler::patch_jump(size_t offset){
+        size_t jump = chunk().size() - offset - 2;
+        if (jump > UINT16_MAX){
+            throw compile_error("Too much code to jump over.");
+        }
+        chunk().patch_short(offset, static_cast<uint16_t>(jump));
+    }
+
+    void Compiler::emit_loop(size_t loop_start){
+        size_t offset = chunk().size() - loop_start + 3;  // Also jump over the LOOP instruction itself.
+        if (offset > UINT16_MAX){
+            throw compile_error("Loop body too large.");
+        }
+        emit_with_short(OpCode::LOOP, static_cast<uint16_t>(offset));
+    }
+
+    void Compiler::emit_return(){
+        // Initialisers always return the instance they were called on.
+        if (current->kind == FuncKind::INITIALISER){
+            emit_with_byte(OpCode::GET_LOCAL, 0);
+        }
+        else{
+            emit(OpCode::NIL);
+        }
+        emit(OpCode::RETURN);
+    }
+
+    uint16_t Compiler::name_constant(const string& name){
+        auto found = current->name_constants.find(name);
+        if (found != current->name_constants.end()){
+            return found->second;
+        }
+        auto idx = static_cast<uint16_t>(chunk().add_constant(name));
+        current->name_constants.insert({name, idx});
+        return idx;
+    }
+
+    // Property names are looked up by symbol at runtime, so instructions refer to them by symbol directly.
+    uint16_t Compiler::name_symbol(const string& name){
+        SymbolId symbol = lox::symbols::intern(name);
+        if (symbol > UINT16_MAX){
+            throw compile_error("Too many property names.");
+        }
+        return static_cast<uint16_t>(symbol);
+    }
+    // endregion
+
+    // region Scopes and variables
+    void Compiler::start_scope(){
+        current->scope_starts.push_back(current->locals.size());
+    }
+
+    void Compiler::finish_scope(){
+        size_t scope_start = current->scope_starts.back();
+        current->scope_starts.pop_back();
+
+        while (current->locals.size() > scope_start){
+            // Captured variables must outlive the scope, so move them off the stack instead of discarding them.
+            emit(current->locals.back().is_captured ? OpCode::CLOSE_UPVALUE : OpCode::POP);
+            current->locals.pop_back();
+        }
+    }
+
+    void Compiler::add_local(const string& name){
+        if (current->locals.size() > UINT8_MAX){
+            throw compile_error("Too many local variables in function.");
+        }
+        current->locals.push_back({name, false});
+    }
+
+    int Compiler::resolve_local(FunctionState* state, const string& name){
+        for (ssize_t i = static_cast<ssize_t>(state->locals.size()) - 1; i >= 0; --i){
+            if (state->locals[i].name == name){
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    int Compiler::add_upvalue(FunctionState* state, ubyte index, bool is_local){
+        for (size_t i = 0; i < state->upvalues.size(); ++i){
+            const UpvalueRef& upvalue = state->upvalues[i];
+            if (upvalue.index == index && upvalue.is_local == is_local){
+                return static_cast<int>(i);
+            }
+        }
+        if (state->upvalues.size() > UINT8_MAX){
+            throw compile_error("Too many closure variables in function.");
+        }
+        state->upvalues.push_back({index, is_local});
+        return static_cast<int>(state->upvalues.size() - 1);
+    }
+
+    int Compiler::resolve_upvalue(FunctionState* state, const string& name){  // NOLINT
+        if (state->enclosing == nullptr){
+            return -1;
+        }
+
+        int local = resolve_local(state->enclosing, name);
+        if (local != -1){
+            state->enclosing->locals[local].is_captured = true;
+            return add_upvalue(state, static_cast<ubyte>(local), true);
+        }
+
+        int upvalue = resolve_upvalue(state->enclosing, name);
+        if (upvalue != -1){
+            return add_upvalue(state, static_cast<ubyte>(upvalue), false);
+        }
+        return -1;
+    }
+
+    void Compiler::get_variable(const string& name){
+        int slot = resolve_local(current, name);
+        if (slot != -1){
+            return emit_with_byte(OpCode::GET_LOCAL, static_cast<ubyte>(slot));
+        }
+        slot = resolve_upvalue(current, name);
+        if (slot != -1){
+            return emit_with_byte(OpCode::GET_UPVALUE, static_cast<ubyte>(slot));
+        }
+        emit_with_short(OpCode::GET_GLOBAL, globals.resolve(name));
+    }
+
+    void Compiler::set_variable(const string& name){
+        int slot = resolve_local(current, name);
+        if (slot != -1){
+            return emit_with_byte(OpCode::SET_LOCAL, static_cast<ubyte>(slot));
+        }
+        slot = resolve_upvalue(current, name);
+        if (slot != -1){
+            return emit_with_byte(OpCode::SET_UPVALUE, static_cast<ubyte>(slot));
+        }
+        emit_with_short(OpCode::SET_GLOBAL, globals.resolve(name));
+    }
+
+    void Compiler::define_variable(const string& name){
+        // The variable's value is on top of the stack: locals simply stay there.
+        if (in_local_scope()){
+            return add_local(name);
+        }
+        emit_with_short(OpCode::DEFINE_GLOBAL, globals.resolve(name));
+    }
+    // endregion
+
+    // region Compile methods for individual expression types
+    void Compiler::compile_literal_expr(ast::LiteralExpr* lit_expr){
+        using ast::LiteralExprType;
+        switch (lit_expr->expr_type){
+            case LiteralExprType::TRUE:
+                return emit(OpCode::TRUE);
+            case LiteralExprType::FALSE:
+                return emit(OpCode::FALSE);
+            case LiteralExprType::NIL:
+                return emit(OpCode::NIL);
+            default:
+                return emit_constant(lit_expr->get_value());
+        }
+    }
+
+    void Compiler::compile_binary_expr(ast::BinaryExpr* bin_expr){
+        using enum Operator;
+        compile(bin_expr->get_left());
+        compile(bin_expr->get_right());
+
+        switch (bin_expr->get_op()){
+            case PLUS:
+                return emit(OpCode::ADD);
+            case MINUS:
+                return emit(OpCode::SUBTRACT);
+            case STAR:
+                return emit(OpCode::MULTIPLY);
+            case SLASH:
+                return emit(OpCode::DIVIDE);
+            case EQUALITY:
+                return emit(OpCode::EQUAL);
+            case INEQUALITY:
+                return emit(OpCode::NOT_EQUAL);
+            case LESS:
+                return emit(OpCode::LESS);
+            case GREATER:
+                return emit(OpCode::GREATER);
+            case LESS_EQUAL:
+                return emit(OpCode::LESS_EQUAL);
+            case GREATER_EQUAL:
+                return emit(OpCode::GREATER_EQUAL);
+            default:
+                throw compile_error("Unsupported binary operator.");
+        }
+    }
+
+    void Compiler::compile_logical_expr(ast::LogicalExpr* log_expr){
+        compile(log_expr->get_left());
+
+        // The left operand is kept as the result if it short-circuits the expression.
+        if (log_expr->get_op() == Operator::AND){
+            size_t end_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+            emit(OpCode::POP);
+            compile(log_expr->get_right());
+            return patch_jump(end_jump);
+        }
+
+        size_t else_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+        size_t end_jump = emit_jump(OpCode::JUMP);
+        patch_jump(else_jump);
+        emit(OpCode::POP);
+        compile(log_expr->get_right());
+        patch_jump(end_jump);
+    }
+
+    void Compiler::compile_unary_expr(ast::UnaryExpr* unary_expr){
+        compile(unary_expr->get_operand());
+
+        switch (unary_expr->get_op()){
+            case Operator::MINUS:
+                return emit(OpCode::NEGATE);
+            case Operator::BANG:
+                return emit(OpCode::NOT);
+            default:
+                throw compile_error("Unsupported unary operator.");
+        }
+    }
+
+    void Compiler::compile_assign_expr(ast::AssignmentExpr* assign_expr){
+        compile(assign_expr->get_value());
+        set_variable(assign_expr->get_name());
+    }
+
+    // Method calls look the method up without binding it, so that calling it does not allocate a bound method.
+    // The property is still looked up before the arguments are evaluated, as the tree-walking engine does.
+    void Compiler::compile_call_expr(ast::CallExpr* call_expr){
+        ExprPtr callee = call_expr->get_callee();
+        OpCode call_op = OpCode::INVOKE;
+        switch (callee->get_kind()){
+            case ast::ExprKind::GET_ATTR:{
+                auto get_attr_expr = static_cast<ast::GetAttrExpr*>(callee);
+                compile(get_attr_expr->get_obj());
+                emit_with_short(OpCode::GET_METHOD, name_symbol(get_attr_expr->get_attr_name()));
+                break;
+            }
+            case ast::ExprKind::SUPER:{
+                auto super_expr = static_cast<ast::SuperExpr*>(callee);
+                get_variable("this");
+                get_variable("super");
+                emit_with_short(OpCode::GET_SUPER_METHOD, name_symbol(super_expr->get_meth_name()));
+                break;
+            }
+            default:
+                compile(callee);
+                call_op = OpCode::CALL;
+                break;
+        }
+
+        vector<ExprPtr> args = call_expr->get_args();
+        for (const auto& arg: args){
+            compile(arg);
+        }
+        emit_with_byte(call_op, static_cast<ubyte>(args.size()));
+    }
+
+    void Compiler::compile_get_expr(ast::GetAttrExpr* get_attr_expr){
+        compile(get_attr_expr->get_obj());
+        emit_with_short(OpCode::GET_PROPERTY, name_symbol(get_attr_expr->get_attr_name()));
+    }
+
+    void Compiler::compile_set_expr(ast::SetAttrExpr* set_attr_expr){
+        compile(set_attr_expr->get_obj());
+        compile(set_attr_expr->get_value());
+        emit_with_short(OpCode::SET_PROPERTY, name_symbol(set_attr_expr->get_attr_name()));
+    }
+
+    void Compiler::compile_super_expr(ast::SuperExpr* super_expr){
+        get_variable("this");
+        get_variable("super");
+        emit_with_short(OpCode::GET_SUPER, name_symbol(super_expr->get_meth_name()));
+    }
+    // endregion
+
+    // region Compile methods for individual statement types
+    void Compiler::compile_function(ast::FunctionStmt* func_stmt, FuncKind kind){
+        FunctionState state{
+            current,
+            make_shared<VmFunction>(func_stmt->get_name(), func_stmt->get_arg_count()),
+            kind
+        };
+        current = &state;
+
+        // Slot zero holds the receiver for methods, and the called closure otherwise.
+        add_local((kind == FuncKind::METHOD || kind == FuncKind::INITIALISER) ? "this" : "");
+        start_scope();
+        for (const auto& arg: func_stmt->get_args()){
+            add_local(arg.get_lexeme());
+        }
+        compile(func_stmt->get_body());
+        emit_return();
+
+        current = state.enclosing;
+        state.function->set_upvalue_count(static_cast<ubyte>(state.upvalues.size()));
+
+        emit_with_short(OpCode::CLOSURE, static_cast<uint16_t>(chunk().add_function(state.function)));
+        for (const auto& upvalue: state.upvalues){
+            chunk().write(static_cast<ubyte>(upvalue.is_local ? 1 : 0));
+            chunk().write(upvalue.index);
+        }
+    }
+
+    void Compiler::compile_class_stmt(ast::ClassStmt* class_stmt){
+        string cls_name = class_stmt->get_name();
+        bool is_local = in_local_scope();
+        size_t cls_slot = 0;
+
+        if (is_local){
+            // Reserve the class's slot first so that methods can refer to the class by name.
+            emit(OpCode::NIL);
+            add_local(cls_name);
+            cls_slot = current->locals.size() - 1;
+        }
+
+        bool has_supercls = class_stmt->has_superclass();
+        if (has_supercls){
+            compile(class_stmt->get_superclass());
+            start_scope();
+            add_local("super");  // Methods capture the superclass through this variable.
+        }
+
+        vector<ast::FunctionStmt*> meths = class_stmt->get_meths();
+        if (meths.size() > UINT8_MAX){
+            throw compile_error("Too many methods in one class.");
+        }
+        for (const auto& meth: meths){
+            compile_function(meth, meth->get_name() == "init" ? FuncKind::INITIALISER : FuncKind::METHOD);
+        }
+
+        if (has_supercls){
+            get_variable("super");
+        }
+        emit_with_short(OpCode::CLASS, name_constant(cls_name));
+        chunk().write(static_cast<ubyte>(meths.size()));
+        chunk().write(static_cast<ubyte>(has_supercls ? 1 : 0));
+
+        if (is_local){
+            emit_with_byte(OpCode::SET_LOCAL, static_cast<ubyte>(cls_slot));
+            emit(OpCode::POP);
+        }
+        else{
+            emit_with_short(OpCode::DEFINE_GLOBAL, globals.resolve(cls_name));
+        }
+
+        if (has_supercls){
+            finish_scope();
+        }
+    }
+
+    void Compiler::compile_block_stmt(ast::BlockStatement* block_stmt){
+        start_scope();
+        compile(block_stmt->get_stmts());
+        finish_scope();
+    }
+
+    void Compiler::compile_variable_stmt(ast::VariableStatement* var_stmt){
+        if (var_stmt->has_initialiser()){
+            compile(var_stmt->get_initialiser());
+        }
+        else{
+            emit(OpCode::NIL);
+        }
+        define_variable(var_stmt->get_name());
+    }
+
+    void Compiler::compile_func_stmt(ast::FunctionStmt* func_stmt){
+        if (in_local_scope()){
+            // Declare the local before compiling the body, so that the function can call itself.
+            add_local(func_stmt->get_name());
+            return compile_function(func_stmt, FuncKind::FUNCTION);
+        }
+        compile_function(func_stmt, FuncKind::FUNCTION);
+        define_variable(func_stmt->get_name());
+    }
+
+    void Compiler::compile_if_stmt(ast::IfStatement* if_stmt){
+        compile(if_stmt->get_condition());
+        size_t then_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+        emit(OpCode::POP);
+        compile(if_stmt->get_success());
+
+        size_t else_jump = emit_jump(OpCode::JUMP);
+        patch_jump(then_jump);
+        emit(OpCode::POP);
+        if (if_stmt->has_failure()){
+            compile(if_stmt->get_failure());
+        }
+        patch_jump(else_jump);
+    }
+
+    void Compiler::compile_while_stmt(ast::WhileStatement* while_stmt){
+        size_t loop_start = chunk().size();
+        compile(while_stmt->get_condition());
+
+        size_t exit_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+        emit(OpCode::POP);
+        compile(while_stmt->get_success());
+        emit_loop(loop_start);
+
+        patch_jump(exit_jump);
+        emit(OpCode::POP);
+    }
+
+    void Compiler::compile_ret_stmt(ast::ReturnStmt* ret_stmt){
+        if (!ret_stmt->has_val()){
+            return emit_return();
+        }
+        compile(ret_stmt->get_expr());
+        emit(OpCode::RETURN);
+    }
+    // endregion
+
+    void Compiler::compile(const ExprPtr& expr){  // NOLINT
+        switch (expr->get_kind()){
+            case ast::ExprKind::LITERAL:
+                return compile_literal_expr(static_cast<ast::LiteralExpr*>(expr));
+            case ast::ExprKind::GROUP:
+                return compile(static_cast<ast::GroupExpr*>(expr)->expr);
+            case ast::ExprKind::LOGICAL:
+                return compile_logical_expr(static_cast<ast::LogicalExpr*>(expr));
+            case ast::ExprKind::BINARY:
+                return compile_binary_expr(static_cast<ast::BinaryExpr*>(expr));
+            case ast::ExprKind::UNARY:
+                return compile_unary_expr(static_cast<ast::UnaryExpr*>(expr));
+            case ast::ExprKind::VARIABLE:
+                return get_variable(static_cast<ast::VariableExpr*>(expr)->get_name());
+            case ast::ExprKind::ASSIGNMENT:
+                return compile_assign_expr(static_cast<ast::AssignmentExpr*>(expr));
+            case ast::ExprKind::CALL:
+                return compile_call_expr(static_cast<ast::CallExpr*>(expr));
+            case ast::ExprKind::GET_ATTR:
+                return compile_get_expr(static_cast<ast::GetAttrExpr*>(expr));
+            case ast::ExprKind::SET_ATTR:
+                return compile_set_expr(static_cast<ast::SetAttrExpr*>(expr));
+            case ast::ExprKind::THIS:
+                return get_variable("this");
+            case ast::ExprKind::SUPER:
+                return compile_super_expr(static_cast<ast::SuperExpr*>(expr));
+        }
+        throw compile_error("Unknown expression type.");
+    }
+
+    void Compiler::compile(const StmtPtr& stmt){  // NOLINT
+        switch (stmt->get_kind()){
+            case ast::StmtKind::CLASS:
+                return compile_class_stmt(static_cast<ast::ClassStmt*>(stmt));
+            case ast::StmtKind::FUNCTION:
+                return compile_func_stmt(static_cast<ast::FunctionStmt*>(stmt));
+            case ast::StmtKind::BLOCK:
+                return compile_block_stmt(static_cast<ast::BlockStatement*>(stmt));
+            case ast::StmtKind::IF:
+                return compile_if_stmt(static_cast<ast::IfStatement*>(stmt));
+            case ast::StmtKind::WHILE:
+                return compile_while_stmt(static_cast<ast::WhileStatement*>(stmt));
+            case ast::StmtKind::VARIABLE:
+                return compile_variable_stmt(static_cast<ast::VariableStatement*>(stmt));
+            case ast::StmtKind::RETURN:
+                return compile_ret_stmt(static_cast<ast::ReturnStmt*>(stmt));
+            case ast::StmtKind::PRINT:
+                compile(static_cast<ast::PrintStatement*>(stmt)->get_expr());
+                return emit(OpCode::PRINT);
+            case ast::StmtKind::EXPR:
+                compile(static_cast<ast::ExprStatement*>(stmt)->get_expr());
+                return emit(OpCode::POP);
+        }
+        throw compile_error("Unknown statement type.");
+    }
+
+    void Compiler::compile(const vector<StmtPtr>& statements){  // NOLINT
+        for (const auto& stmt: statements){
+            compile(stmt);
+        }
+    }
+
+    shared_ptr<VmFunction> Compiler::compile_script(const vector<StmtPtr>& statements){
+        FunctionState state{nullptr, make_shared<VmFunction>("", 0), FuncKind::SCRIPT};
+        current = &state;
+
+        add_local("");  // The script's own closure.
+        compile(statements);
+        emit_return();
+
+        current = nullptr;
+        return state.function;
+    }
+}
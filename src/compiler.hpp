@@ -0,0 +1,143 @@
+#pragma once
+#include "ast.hpp"
+#include "chunk.hpp"
+#include "exceptions.hpp"
+#include "parser.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lox::vm{
+    using lox::ast::Operator;
+    using lox::parser::ExprPtr;
+    using lox::parser::StmtPtr;
+    using lox::symbols::SymbolId;
+
+    using std::make_shared;
+    using std::shared_ptr;
+    using std::string;
+    using std::uint16_t;
+    using std::unordered_map;
+    using std::vector;
+
+    // Maps global variable names to the index of their slot in the VM's global array.
+    // Globals are late-bound in Lox, so a slot may be referenced before the variable is defined.
+    class GlobalTable{
+        unordered_map<string, uint16_t> ids;
+        vector<string> names;
+
+        public:
+            uint16_t resolve(const string& name);
+
+            [[nodiscard]] const string& get_name(uint16_t id) const{
+                return names[id];
+            }
+
+            [[nodiscard]] size_t size() const{
+                return names.size();
+            }
+    };
+
+    enum class FuncKind: ubyte{
+        SCRIPT,
+        FUNCTION,
+        METHOD,
+        INITIALISER
+    };
+
+    // Turns a resolved syntax tree into bytecode for the VM.
+    // Static errors are expected to have been reported by the resolver beforehand.
+    class Compiler{
+        struct Local{
+            string name;
+            bool is_captured;
+        };
+
+        struct UpvalueRef{
+            ubyte index;
+            bool is_local;
+        };
+
+        // Per-function compilation state. Nested function declarations push a new state.
+        struct FunctionState{
+            FunctionState* enclosing;
+            shared_ptr<VmFunction> function;
+            FuncKind kind;
+            vector<Local> locals{};
+            vector<size_t> scope_starts{};  // Number of locals alive when each nested scope was opened.
+            vector<UpvalueRef> upvalues{};
+            unordered_map<string, uint16_t> name_constants{};
+        };
+
+        GlobalTable& globals;
+        FunctionState* current = nullptr;
+
+        [[nodiscard]] Chunk& chunk(){
+            return current->function->get_chunk();
+        }
+
+        // region Emission helpers
+        void emit(OpCode op);
+        void emit_with_byte(OpCode op, ubyte operand);
+        void emit_with_short(OpCode op, uint16_t operand);
+        void emit_constant(const Value& value);
+        size_t emit_jump(OpCode op);
+        void patch_jump(size_t offset);
+        void emit_loop(size_t loop_start);
+        void emit_return();
+        uint16_t name_constant(const string& name);
+        static uint16_t name_symbol(const string& name);
+        // endregion
+
+        // region Scopes and variables
+        [[nodiscard]] bool in_local_scope() const{
+            return !current->scope_starts.empty();
+        }
+
+        void start_scope();
+        void finish_scope();
+        void add_local(const string& name);
+        static int resolve_local(FunctionState* state, const string& name);
+        static int add_upvalue(FunctionState* state, ubyte index, bool is_local);
+        static int resolve_upvalue(FunctionState* state, const string& name);
+        void get_variable(const string& name);
+        void set_variable(const string& name);
+        void define_variable(const string& name);
+        // endregion
+
+        // region Compile methods for individual expression types
+        void compile_literal_expr(ast::LiteralExpr* lit_expr);
+        void compile_binary_expr(ast::BinaryExpr* bin_expr);
+        void compile_logical_expr(ast::LogicalExpr* log_expr);
+        void compile_unary_expr(ast::UnaryExpr* unary_expr);
+        void compile_assign_expr(ast::AssignmentExpr* assign_expr);
+        void compile_call_expr(ast::CallExpr* call_expr);
+        void compile_get_expr(ast::GetAttrExpr* get_attr_expr);
+        void compile_set_expr(ast::SetAttrExpr* set_attr_expr);
+        void compile_super_expr(ast::SuperExpr* super_expr);
+        // endregion
+
+        // region Compile methods for individual statement types
+        void compile_function(ast::FunctionStmt* func_stmt, FuncKind kind);
+        void compile_class_stmt(ast::ClassStmt* class_stmt);
+        void compile_block_stmt(ast::BlockStatement* block_stmt);
+        void compile_variable_stmt(ast::VariableStatement* var_stmt);
+        void compile_func_stmt(ast::FunctionStmt* func_stmt);
+        void compile_if_stmt(ast::IfStatement* if_stmt);
+        void compile_while_stmt(ast::WhileStatement* while_stmt);
+        void compile_ret_stmt(ast::ReturnStmt* ret_stmt);
+        // endregion
+
+        void compile(const ExprPtr& expr);
+        void compile(const StmtPtr& stmt);
+        void compile(const vector<StmtPtr>& statements);
+
+        public:
+            explicit Compiler(GlobalTable& globals): globals(globals){}
+
+            // Compiles a whole program into the function run as the script's entry point.
+            [[nodiscard]] shared_ptr<VmFunction> compile_script(const vector<StmtPtr>& statements);
+    };
+}
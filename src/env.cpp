@@ -3,70 +3,62 @@
 //
 
 #include "env.hpp"
+#include "gc.hpp"
 
 #include <utility>
 
 namespace lox::env{
-    // The top-level environment does not have a parent environment,
-    // so its enclosing member is set to nullptr.
-    Environment::Environment(): enclosing(nullptr){}
+    Environment::Environment(): Obj(ObjType::ENVIRONMENT){}
 
-    // Allows for nested variable scopes.
-    Environment::Environment(const EnvPtr& enclosing_env): enclosing(enclosing_env){}
-
-    VarValue Environment::get(const string& name){  // NOLINT
-        try{
-            return vars.at(name);
-        }
-        catch (const out_of_range& exc){
-            if (enclosing != nullptr){
-                return enclosing->get(name);
-            }
-            throw runtime_error("Attempting to access nonexistent variable '" + name + "'");
+    void Environment::trace(Tracer& tracer) const{
+        for (const auto& value: values){
+            tracer.visit(value);
         }
     }
 
-    void Environment::set(const string& name, VarValue value){
-        vars.insert_or_assign(name, value);
+    void Environment::clear_refs(){
+        values.clear();
+        defined.clear();
     }
 
-    EnvPtr Environment::get_ancestor(size_t distance){
-        auto ret = shared_from_this();
-        for (size_t i = 0; i < distance; ++i){
-            ret = ret->get_enclosing();
+    // Only the caller decides whether a missing variable is an error.
+    VarValue* Environment::find(SymbolId name){
+        if (name < defined.size() && defined[name]){
+            return &values[name];
         }
-        return ret;
+        return nullptr;
     }
 
-    VarValue Environment::get_at(size_t distance, const string& name){
-        return get_ancestor(distance)->get(name);
-    }
-
-    void Environment::assign(const string& name, VarValue value){  // NOLINT
-        if (!vars.contains(name)){
-            if (enclosing != nullptr){
-                return enclosing->assign(name, value);
-            }
-            throw runtime_error("Undefined variable '" + name + "'");
+    VarValue Environment::get(SymbolId name){
+        VarValue* found = find(name);
+        if (found == nullptr){
+            throw runtime_error("Attempting to access nonexistent variable '" + lox::symbols::get_name(name) + "'");
         }
-        vars[name] = std::move(value);
+        return *found;
     }
 
-    void Environment::assign_at(size_t distance, const string& name, VarValue val){
-        get_ancestor(distance)->assign(name, val);
+    void Environment::set(SymbolId name, VarValue value){
+        if (name >= values.size()){
+            values.resize(name + 1);
+            defined.resize(name + 1, false);
+        }
+        values[name] = std::move(value);
+        defined[name] = true;
     }
 
-    namespace for_callable{
-        EnvPtr get_child_env(const EnvPtr& orig){
-            return make_shared<Environment>(orig);
+    void Environment::assign(SymbolId name, VarValue value){
+        VarValue* found = find(name);
+        if (found == nullptr){
+            throw runtime_error("Undefined variable '" + lox::symbols::get_name(name) + "'");
         }
+        *found = std::move(value);
+    }
 
-        VarValue value_of_this(const EnvPtr& orig){
-            return orig->get_at(0, "this");
-        }
+    void Upvalue::trace(Tracer& tracer) const{
+        tracer.visit(closed);
+    }
 
-        void set_env_member(const EnvPtr& func_env, const string& name, VarValue value){
-            func_env->set(name, value);
-        }
+    void Upvalue::clear_refs(){
+        closed = VarValue::nil();
     }
-}
\ No newline at end of file
+}
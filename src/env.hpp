@@ -4,15 +4,21 @@
 
 #pragma once
 #include "callable.hpp"
+#include "symbols.hpp"
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
 #include <variant>
 
 namespace lox::env{
-    using std::enable_shared_from_this;
+    using lox::value::make_obj;
+    using lox::value::Obj;
+    using lox::value::ObjType;
+    using lox::value::Ref;
+    using lox::value::Tracer;
+    using lox::symbols::SymbolId;
+
     using std::make_shared;
-    using std::out_of_range;
     using std::runtime_error;
     using std::shared_ptr;
     using std::string;
@@ -20,42 +26,85 @@ namespace lox::env{
     using std::variant;
 
     using lox::callable::VarValue;
+    using std::vector;
 
     class Environment;
 
-    using EnvPtr = shared_ptr<Environment>;
+    using EnvPtr = Ref<Environment>;
+
+    // Where a variable lives at runtime.
+    enum class VarStorage: ubyte{
+        GLOBAL,   // Not found in any local scope: 'slot' is the symbol of its name.
+        FRAME,    // Index 'slot' of the current call frame.
+        UPVALUE   // Captured from an enclosing function: index 'slot' of the running closure's upvalues.
+    };
+
+    // Where the resolver found a variable.
+    struct VarLocation{
+        size_t slot = 0;
+        VarStorage storage = VarStorage::GLOBAL;
+    };
 
-    class Environment: public enable_shared_from_this<Environment>{
-        unordered_map<string, VarValue> vars;
-        EnvPtr enclosing; // Reference to parent environment for local scopes.
+    inline VarLocation global_location(const string& name){
+        return {lox::symbols::intern(name), VarStorage::GLOBAL};
+    }
+
+    // Global variables. Locals live in call frames, and closures capture them through upvalues instead.
+    // Environments are heap objects so that the collector can trace the values they hold.
+    // Names are interned, so a global is found by indexing with the symbol of its name rather than hashing it.
+    class Environment: public Obj{
+        vector<VarValue> values;  // Indexed by symbol.
+        vector<bool> defined;
 
         public:
             Environment();
 
-            explicit Environment(const EnvPtr& enclosing_env);
+            void trace(Tracer& tracer) const final;
 
-            [[nodiscard]] EnvPtr get_enclosing(){
-                return enclosing;
-            }
+            void clear_refs() final;
 
-            [[nodiscard]] VarValue get(const string& name);
+            // Returns the variable with the given name, or nullptr if there is none.
+            [[nodiscard]] VarValue* find(SymbolId name);
 
-            void set(const string& name, VarValue val);
+            [[nodiscard]] VarValue get(SymbolId name);
 
-            void assign(const string& name, VarValue val);
+            void set(SymbolId name, VarValue val);
 
-            [[nodiscard]] EnvPtr get_ancestor(size_t distance);
+            void assign(SymbolId name, VarValue val);
+    };
 
-            [[nodiscard]] VarValue get_at(size_t distance, const string& name);
+    // A local variable captured by a closure.
+    // It refers to a slot of the interpreter's frame stack while that slot is alive (open),
+    // then owns a copy of the value once the variable's scope has ended (closed).
+    class Upvalue: public Obj{
+        size_t slot;
+        VarValue closed;
+        bool open = true;
 
-            void assign_at(size_t distance, const string& name, VarValue val);
-    };
+        public:
+            explicit Upvalue(size_t slot): Obj(ObjType::UPVALUE), slot(slot){}
 
-    namespace for_callable{
-        EnvPtr get_child_env(const EnvPtr& orig);
+            [[nodiscard]] bool is_open() const{
+                return open;
+            }
 
-        VarValue value_of_this(const EnvPtr& orig);
+            [[nodiscard]] size_t get_slot() const{
+                return slot;
+            }
 
-        void set_env_member(const EnvPtr& func_env, const string& name, VarValue value);
-    }
+            [[nodiscard]] VarValue& get_closed(){
+                return closed;
+            }
+
+            void close(VarValue value){
+                closed = std::move(value);
+                open = false;
+            }
+
+            void trace(Tracer& tracer) const final;
+
+            void clear_refs() final;
+    };
+
+    using UpvaluePtr = Ref<Upvalue>;
 }
@@ -4,7 +4,6 @@
 
 #pragma once
 #include <stdexcept>
-#include "callable.hpp"
 #include "utils.hpp"
 
 namespace lox{
@@ -24,26 +23,22 @@ namespace lox{
         }
     };
 
-    namespace priv{
-        using lox::callable::Value;
-    }
-
-    class return_exc: public exception{
-        priv::Value ret_val;
+    class resolve_error: public exception{
+        const char* message;
 
         public:
-            return_exc(priv::Value ret_val): exception(), ret_val(ret_val){}
+            resolve_error(const char* msg): message(msg){}
 
-            [[nodiscard]] priv::Value get_returned_val() const{
-                return ret_val;
+            [[nodiscard]] const char* what() const noexcept override{
+                return message;
             }
     };
 
-    class resolve_error: public exception{
+    class compile_error: public exception{
         const char* message;
 
         public:
-            resolve_error(const char* msg): message(msg){}
+            compile_error(const char* msg): message(msg){}
 
             [[nodiscard]] const char* what() const noexcept override{
                 return message;
@@ -0,0 +1,116 @@
+#include "gc.hpp"
+
+namespace lox::gc{
+    // Subtracts the references found inside the heap from each object's count.
+    class Heap::InternalRefCounter: public Tracer{
+        public:
+            void visit(Obj* obj) final;
+    };
+
+    class Heap::Marker: public Tracer{
+        public:
+            vector<Obj*> gray;
+
+            void visit(Obj* obj) final;
+    };
+
+    Heap& Heap::get(){
+        static Heap heap;
+        return heap;
+    }
+
+    void Heap::track(Obj* obj){
+        obj->gc_next = objects;
+        if (objects != nullptr){
+            objects->gc_prev = obj;
+        }
+        objects = obj;
+        ++object_count;
+    }
+
+    void Heap::untrack(Obj* obj){
+        if (obj->gc_prev != nullptr){
+            obj->gc_prev->gc_next = obj->gc_next;
+        }
+        else{
+            objects = obj->gc_next;
+        }
+        if (obj->gc_next != nullptr){
+            obj->gc_next->gc_prev = obj->gc_prev;
+        }
+        --object_count;
+    }
+
+    void Heap::set_threshold(size_t new_threshold){
+        threshold = new_threshold;
+        next_collection = new_threshold;
+    }
+
+    void Heap::add_root_source(const RootSource* source){
+        root_sources.push_back(source);
+    }
+
+    void Heap::remove_root_source(const RootSource* source){
+        std::erase(root_sources, source);
+    }
+
+    void Heap::InternalRefCounter::visit(Obj* obj){
+        if (obj->is_traced()){
+            --obj->gc_refs;
+        }
+    }
+
+    void Heap::Marker::visit(Obj* obj){
+        if (obj->is_traced() && !obj->gc_marked){
+            obj->gc_marked = true;
+            gray.push_back(obj);
+        }
+    }
+
+    size_t Heap::collect(){
+        for (Obj* obj = objects; obj != nullptr; obj = obj->gc_next){
+            obj->gc_refs = obj->ref_count;
+            obj->gc_marked = false;
+        }
+        InternalRefCounter counter;
+        for (Obj* obj = objects; obj != nullptr; obj = obj->gc_next){
+            obj->trace(counter);
+        }
+
+        Marker marker;
+        for (const RootSource* source: root_sources){
+            source->trace_roots(marker);
+        }
+        for (Obj* obj = objects; obj != nullptr; obj = obj->gc_next){
+            if (obj->gc_refs > 0){
+                marker.visit(obj);
+            }
+        }
+        while (!marker.gray.empty()){
+            Obj* obj = marker.gray.back();
+            marker.gray.pop_back();
+            obj->trace(marker);
+        }
+
+        vector<Obj*> garbage;
+        for (Obj* obj = objects; obj != nullptr; obj = obj->gc_next){
+            if (!obj->gc_marked){
+                garbage.push_back(obj);
+            }
+        }
+        // Keep every piece of garbage alive until all of their references have been dropped,
+        // so that freeing one never touches another that was already freed.
+        for (Obj* obj: garbage){
+            obj->retain();
+        }
+        for (Obj* obj: garbage){
+            obj->clear_refs();
+        }
+        for (Obj* obj: garbage){
+            obj->release();
+        }
+
+        next_collection = std::max(threshold, object_count * 2);
+        return garbage.size();
+    }
+}
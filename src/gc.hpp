@@ -0,0 +1,92 @@
+#pragma once
+#include "value.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace lox::gc{
+    using lox::value::Obj;
+    using lox::value::Ref;
+    using lox::value::Value;
+
+    using std::vector;
+
+    // Visits the references held by an object or by an engine.
+    class Tracer{
+        public:
+            virtual ~Tracer() = default;
+
+            virtual void visit(Obj* obj) = 0;
+
+            void visit(const Value& val){
+                if (val.is_obj()){
+                    visit(val.as_obj());
+                }
+            }
+
+            template<class T> void visit(const Ref<T>& ref){
+                if (ref != nullptr){
+                    visit(static_cast<Obj*>(ref.get()));
+                }
+            }
+    };
+
+    // Implemented by the engines, to expose the objects they reference from outside of the heap.
+    class RootSource{
+        public:
+            virtual ~RootSource() = default;
+
+            virtual void trace_roots(Tracer& tracer) const = 0;
+    };
+
+    // Reclaims cycles of objects that reference counting alone cannot free.
+    //
+    // Collection is a mark-sweep over every traced object. Roots are the ones reported by the registered
+    // root sources (the interpreter's environments, the VM's stack and globals), plus any object with more
+    // references than the heap itself accounts for, which means something on the C++ side still holds it.
+    // Everything left unmarked is only referenced by other garbage: its references are dropped first,
+    // which lets the reference counts free it.
+    class Heap{
+        class InternalRefCounter;
+        class Marker;
+
+        Obj* objects = nullptr;  // Intrusive list of every traced object.
+        size_t object_count = 0;
+        size_t threshold = DEFAULT_THRESHOLD;
+        size_t next_collection = DEFAULT_THRESHOLD;
+        vector<const RootSource*> root_sources;
+
+        Heap() = default;
+
+        public:
+            static constexpr size_t DEFAULT_THRESHOLD = 10000;
+
+            Heap(const Heap&) = delete;
+            Heap& operator=(const Heap&) = delete;
+
+            static Heap& get();
+
+            void track(Obj* obj);
+            void untrack(Obj* obj);
+
+            [[nodiscard]] size_t get_object_count() const{
+                return object_count;
+            }
+
+            // Minimum number of live traced objects before a collection runs.
+            void set_threshold(size_t new_threshold);
+
+            void add_root_source(const RootSource* source);
+            void remove_root_source(const RootSource* source);
+
+            // Must only be called where no object is under construction, e.g. between statements or instructions.
+            void collect_if_needed(){
+                if (object_count >= next_collection){
+                    collect();
+                }
+            }
+
+            // Returns the number of objects freed.
+            size_t collect();
+    };
+}
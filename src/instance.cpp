@@ -3,32 +3,98 @@
 //
 
 #include "instance.hpp"
+#include "gc.hpp"
 
 namespace lox::inst{
-    LoxInstance::LoxInstance(const ClassPtr& klass): cls(klass){
+    LoxInstance::LoxInstance(const ClassPtr& klass): Obj(ObjType::INSTANCE), cls(klass), shape(klass->get_root_shape()){
 
     }
 
-    VarValue LoxInstance::get_attr(const string& name){
-        if (fields.contains(name)){
-            return fields.at(name);
+    VarValue LoxInstance::bind_method(const CallablePtr& meth, SymbolId name){
+        if (meth == nullptr){
+            throw runtime_error("Undefined property '" + lox::symbols::get_name(name) + "' for " + to_string() + ".");
         }
+        return meth->bind(Ref<LoxInstance>(this));
+    }
+
+    VarValue LoxInstance::get_attr(SymbolId name){
+        size_t slot = shape->find(name);
+        if (slot != Shape::NOT_FOUND){
+            return fields[slot];
+        }
+        return bind_method(cls->find_meth(name), name);
+    }
 
-        auto meth = cls->find_meth(name);
-        if (meth != nullptr){
-            return meth->bind(shared_from_this());
+    void LoxInstance::update_read_cache(SymbolId name, PropertyCache& cache) const{
+        if (cache.shape_id != shape->get_id()){
+            cache.shape_id = shape->get_id();
+            cache.transition = nullptr;
+            cache.slot = shape->find(name);
+            // Fields shadow methods.
+            cache.method = cache.slot == Shape::NOT_FOUND ? cls->find_meth(name).get() : nullptr;
         }
+    }
 
-        throw runtime_error("Undefined property '" + name + "' for " + to_string() + ".");
+    VarValue LoxInstance::get_attr(SymbolId name, PropertyCache& cache){
+        update_read_cache(name, cache);
+        if (cache.slot != Shape::NOT_FOUND){
+            return fields[cache.slot];
+        }
+        return bind_method(CallablePtr(cache.method), name);
+    }
+
+    CallablePtr LoxInstance::find_method(SymbolId name) const{
+        // Fields shadow methods.
+        return shape->find(name) == Shape::NOT_FOUND ? cls->find_meth(name) : nullptr;
+    }
+
+    CallablePtr LoxInstance::find_method(SymbolId name, PropertyCache& cache){
+        update_read_cache(name, cache);
+        return CallablePtr(cache.method);
+    }
+
+    void LoxInstance::set_attr(SymbolId name, VarValue val){
+        size_t slot = shape->find(name);
+        if (slot != Shape::NOT_FOUND){
+            fields[slot] = std::move(val);
+            return;
+        }
+        shape = shape->with_field(name);
+        fields.push_back(std::move(val));
+    }
+
+    void LoxInstance::set_attr(SymbolId name, VarValue val, PropertyCache& cache){
+        if (cache.shape_id != shape->get_id()){
+            cache.shape_id = shape->get_id();
+            cache.method = nullptr;
+            cache.slot = shape->find(name);
+            cache.transition = cache.slot == Shape::NOT_FOUND ? shape->with_field(name) : nullptr;
+        }
+        if (cache.transition != nullptr){
+            shape = cache.transition;
+            fields.push_back(std::move(val));
+        }
+        else{
+            fields[cache.slot] = std::move(val);
+        }
+    }
+
+    void LoxInstance::trace(Tracer& tracer) const{
+        tracer.visit(cls);
+        for (const auto& value: fields){
+            tracer.visit(value);
+        }
     }
 
-    void LoxInstance::set_attr(const string& name, VarValue val){
-        fields.insert_or_assign(name, val);
+    void LoxInstance::clear_refs(){
+        cls = nullptr;
+        shape = nullptr;
+        fields.clear();
     }
 
     namespace for_callable{
-        shared_ptr<LoxInstance> create_inst(const ClassPtr& cls){
-            return make_shared<LoxInstance>(cls);
+        Ref<LoxInstance> create_inst(const ClassPtr& cls){
+            return make_obj<LoxInstance>(cls);
         }
     }
 }
@@ -10,21 +10,49 @@
 #include <unordered_map>
 
 namespace lox::inst{
+    using lox::callable::AbstractLoxCallable;
     using lox::callable::LoxClass;
     using lox::callable::VarValue;
+    using lox::value::make_obj;
+    using lox::value::Obj;
+    using lox::value::ObjType;
+    using lox::value::Ref;
+    using lox::shape::Shape;
+    using lox::value::Tracer;
+    using lox::symbols::SymbolId;
 
-    using std::enable_shared_from_this;
     using std::make_shared;
     using std::runtime_error;
     using std::shared_ptr;
     using std::string;
     using std::unordered_map;
+    using std::vector;
 
-    using ClassPtr = shared_ptr<LoxClass>;
+    using ClassPtr = Ref<LoxClass>;
 
-    class LoxInstance: public enable_shared_from_this<LoxInstance>{
+    using lox::callable::CallablePtr;
+
+    // Remembers what a property access site resolved the last time it ran, keyed by the shape of the instance.
+    // Shapes belong to a single class, whose methods cannot change once it is created,
+    // so a hit is an identifier comparison followed by an indexed load.
+    // Access sites live as long as the program, so the cache holds no reference: it must not keep classes alive.
+    // Everything it points to is owned by the class of the shape, which the instance being accessed keeps alive on a hit.
+    struct PropertyCache{
+        uint64_t shape_id = Shape::NO_ID;
+        size_t slot = Shape::NOT_FOUND;  // Slot of the field, if instances of that shape have one.
+        AbstractLoxCallable* method = nullptr;  // Method found otherwise, or nullptr.
+        Shape* transition = nullptr;  // For assignments adding a new field: shape of the instance afterwards.
+    };
+
+    class LoxInstance: public Obj{
         ClassPtr cls;
-        unordered_map<string, VarValue> fields;
+        Shape* shape;  // Owned by the class.
+        vector<VarValue> fields;  // Indexed by the slots of the shape.
+
+        // Retrieves the method with the given name, bound to this instance.
+        [[nodiscard]] VarValue bind_method(const CallablePtr& meth, SymbolId name);
+
+        void update_read_cache(SymbolId name, PropertyCache& cache) const;
 
         public:
             explicit LoxInstance(const ClassPtr& klass);
@@ -33,12 +61,31 @@ namespace lox::inst{
                 return cls->to_string() + " instance";
             }
 
-            [[nodiscard]] VarValue get_attr(const string& name);
+            [[nodiscard]] VarValue get_attr(SymbolId name);
+
+            // Same as above, going through the cache of the access site first.
+            [[nodiscard]] VarValue get_attr(SymbolId name, PropertyCache& cache);
+
+            // Returns the method the given property names, without binding it, or nullptr if the property is not a method.
+            [[nodiscard]] CallablePtr find_method(SymbolId name) const;
 
-            void set_attr(const string& name, VarValue val);
+            // Same as above, going through the cache of the access site first.
+            [[nodiscard]] CallablePtr find_method(SymbolId name, PropertyCache& cache);
+
+            void set_attr(SymbolId name, VarValue val);
+
+            void set_attr(SymbolId name, VarValue val, PropertyCache& cache);
+
+            void trace(Tracer& tracer) const final;
+
+            void clear_refs() final;
     };
 
     namespace for_callable{
-        shared_ptr<LoxInstance> create_inst(const ClassPtr& cls);
+        Ref<LoxInstance> create_inst(const ClassPtr& cls);
     }
 }
+
+inline lox::value::Ref<lox::inst::LoxInstance> lox::value::Value::as_instance() const{
+    return Ref<LoxInstance>(static_cast<LoxInstance*>(as_obj()));
+}
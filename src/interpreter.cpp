@@ -3,94 +3,161 @@
 //
 
 #include "interpreter.hpp"
+#include <algorithm>
+#include <sys/resource.h>
 
 namespace lox::interpreter{
-    VarValue Interpreter::look_up_variable(const string& name, const ExprPtr& expr){
-        if (locals.contains(expr)){
-            return env->get_at(locals.at(expr), name);
+    VarValue Interpreter::look_up_variable(const VarLocation& location){
+        switch (location.storage){
+            case VarStorage::FRAME:
+                return frame_slots[frame_base + location.slot];
+            case VarStorage::UPVALUE:{
+                Upvalue& upvalue = *get_upvalue(location.slot);
+                return upvalue.is_open() ? frame_slots[upvalue.get_slot()] : upvalue.get_closed();
+            }
+            default:
+                return globals->get(static_cast<SymbolId>(location.slot));
         }
-        return globals->get(name);
     }
 
-    void Interpreter::assign_var(const string& name, const ExprPtr& expr){
-        VarValue val = expr->evaluate(shared_from_this());
-        if (locals.contains(expr)){
-            env->assign_at(
-                locals.at(expr),
-                name,
-                val
-            );
+    void Interpreter::assign_var(const VarLocation& location, VarValue value){
+        switch (location.storage){
+            case VarStorage::FRAME:
+                frame_slots[frame_base + location.slot] = std::move(value);
+                break;
+            case VarStorage::UPVALUE:{
+                Upvalue& upvalue = *get_upvalue(location.slot);
+                (upvalue.is_open() ? frame_slots[upvalue.get_slot()] : upvalue.get_closed()) = std::move(value);
+                break;
+            }
+            default:
+                globals->assign(static_cast<SymbolId>(location.slot), std::move(value));
+                break;
+        }
+    }
+
+    // Declarations always happen in the innermost scope, which is never reached through an upvalue.
+    void Interpreter::define_var(const VarLocation& location, VarValue value){
+        if (location.storage == VarStorage::FRAME){
+            frame_slots[frame_base + location.slot] = std::move(value);
         }
         else{
-            globals->assign(name, val);
+            globals->set(static_cast<SymbolId>(location.slot), std::move(value));
+        }
+    }
+
+    UpvaluePtr Interpreter::capture_upvalue(size_t slot){
+        // Closures capturing the same variable must share the same upvalue.
+        size_t absolute_slot = frame_base + slot;
+        auto it = open_upvalues.end();
+        while (it != open_upvalues.begin() && (*(it - 1))->get_slot() >= absolute_slot){
+            --it;
+            if ((*it)->get_slot() == absolute_slot){
+                return *it;
+            }
+        }
+        auto created = make_obj<Upvalue>(absolute_slot);
+        open_upvalues.insert(it, created);
+        return created;
+    }
+
+    void Interpreter::close_upvalues(size_t slot){
+        size_t absolute_slot = frame_base + slot;
+        while (!open_upvalues.empty() && open_upvalues.back()->get_slot() >= absolute_slot){
+            Upvalue& upvalue = *open_upvalues.back();
+            upvalue.close(frame_slots[upvalue.get_slot()]);
+            open_upvalues.pop_back();
         }
     }
 
     void Interpreter::define_builtins(){
-        globals->set("clock", make_shared<builtins::ClockFunc>());
-        globals->set("cos", make_shared<builtins::CosFunc>());
-        globals->set("sin", make_shared<builtins::SinFunc>());
+        globals->set(intern("clock"), make_obj<builtins::ClockFunc>());
+        globals->set(intern("cos"), make_obj<builtins::CosFunc>());
+        globals->set(intern("sin"), make_obj<builtins::SinFunc>());
     }
 
-    Interpreter::Interpreter(const string& file_contents){
-        env = make_shared<Environment>();
-        globals = env;
-        define_builtins();
-        bool contains_errors = false;
+    // The native stack grows downwards from about where the interpreter is created, since programs run not far
+    // below main. Unlimited stacks are treated as the usual 8 MiB.
+    static uintptr_t get_stack_limit(){
+        constexpr rlim_t default_size = 8 * 1024 * 1024;
+        rlimit limit{};
+        rlim_t size = default_size;
+        if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY){
+            size = limit.rlim_cur;
+        }
+        size = std::max(size, static_cast<rlim_t>(2 * Interpreter::STACK_MARGIN)) - Interpreter::STACK_MARGIN;
 
-        Parser parser = Parser(tokenize(file_contents, &contains_errors));
-        statements = parser.parse();
+        char marker;
+        return reinterpret_cast<uintptr_t>(&marker) - size;
     }
 
-    Interpreter::Interpreter(const vector<StmtPtr>& statements): statements(statements){
-        env = make_shared<Environment>();
-        globals = env;
+    Interpreter::Interpreter(const vector<StmtPtr>& statements, size_t frame_size)
+        : statements(statements), frame_slots(frame_size), stack_limit(get_stack_limit()){
+        globals = make_obj<Environment>();
         define_builtins();
+        Heap::get().add_root_source(this);
     }
 
-    void Interpreter::run(){
-        shared_ptr<Interpreter> shared = shared_from_this();
-        for (const auto& stmt: statements){
-            stmt->execute(shared);
+    Interpreter::~Interpreter(){
+        Heap::get().remove_root_source(this);
+    }
+
+    void Interpreter::trace_roots(Tracer& tracer) const{
+        tracer.visit(globals);
+        for (const auto& value: frame_slots){
+            tracer.visit(value);
+        }
+        for (const auto& upvalue: open_upvalues){
+            tracer.visit(upvalue);
         }
     }
 
-    void run(const string& file_contents){
-        shared_ptr<Interpreter> interpreter = make_shared<Interpreter>(file_contents);
-        interpreter->run();
+    void Interpreter::run(){
+        for (const auto& stmt: statements){
+            stmt->execute(*this);
+            Heap::get().collect_if_needed();
+        }
     }
 
     namespace for_ast{
-        VarValue look_up_var(const shared_ptr<Interpreter>& interpreter, const string& name, const shared_ptr<ast::Expr>& expr){
-            return interpreter->look_up_variable(name, expr);
+        VarValue look_up_var(Interpreter& interpreter, const VarLocation& location){
+            return interpreter.look_up_variable(location);
+        }
+
+        void assign_var(Interpreter& interpreter, const VarLocation& location, VarValue value){
+            interpreter.assign_var(location, std::move(value));
+        }
+
+        void define_var(Interpreter& interpreter, const VarLocation& location, VarValue value){
+            interpreter.define_var(location, std::move(value));
         }
 
-        void assign_var(const shared_ptr<Interpreter>& interpreter, const string& name, const ExprPtr& expr){
-            interpreter->assign_var(name, expr);
+        size_t push_frame(Interpreter& interpreter, size_t size){
+            return interpreter.push_frame(size);
         }
 
-        size_t get_super_dist(const shared_ptr<Interpreter>& interpreter, const shared_ptr<ast::SuperExpr>& expr){
-            return interpreter->locals.at(expr);
+        void pop_frame(Interpreter& interpreter, size_t previous_base){
+            interpreter.pop_frame(previous_base);
         }
 
-        shared_ptr<Environment> get_current_env(const shared_ptr<Interpreter>& interpreter){
-            return interpreter->get_current_env();
+        void set_frame_slot(Interpreter& interpreter, size_t slot, VarValue value){
+            interpreter.set_frame_slot(slot, std::move(value));
         }
 
-        void set_current_env(const shared_ptr<Interpreter>& interpreter, const shared_ptr<Environment>& env){
-            interpreter->set_current_env(env);
+        const vector<UpvaluePtr>* set_upvalues(Interpreter& interpreter, const vector<UpvaluePtr>* upvalues){
+            return interpreter.set_upvalues(upvalues);
         }
 
-        void return_to_previous_env(const shared_ptr<Interpreter>& interpreter){
-            interpreter->return_to_previous_env();
+        UpvaluePtr get_upvalue(Interpreter& interpreter, size_t index){
+            return interpreter.get_upvalue(index);
         }
 
-        void add_nesting_level(const shared_ptr<Interpreter>& interpreter){
-            interpreter->add_nesting_level();
+        UpvaluePtr capture_upvalue(Interpreter& interpreter, size_t slot){
+            return interpreter.capture_upvalue(slot);
         }
 
-        void remove_nesting_level(const shared_ptr<Interpreter>& interpreter){
-            interpreter->remove_nesting_level();
+        void close_upvalues(Interpreter& interpreter, size_t slot){
+            interpreter.close_upvalues(slot);
         }
     }
 }
\ No newline at end of file
@@ -9,8 +9,9 @@
 #include "exceptions.hpp"
 #include "callable.hpp"
 #include "ast.hpp"
+#include "gc.hpp"
+#include <cstdint>
 #include <memory>
-#include <stack>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -20,99 +21,129 @@ namespace lox::interpreter{
     namespace builtins = lox::callable::builtins;
     using lox::env::Environment;
     using lox::env::EnvPtr;
+    using lox::env::Upvalue;
+    using lox::env::UpvaluePtr;
+    using lox::env::VarLocation;
+    using lox::env::VarStorage;
     using lox::callable::VarValue;
+    using lox::gc::Heap;
+    using lox::gc::RootSource;
+    using lox::gc::Tracer;
+    using lox::value::make_obj;
     using lox::parser::ExprPtr;
     using lox::parser::Parser;
     using lox::parser::StmtPtr;
+    using lox::symbols::intern;
+    using lox::symbols::SymbolId;
     using lox::tokenizer::token::Token;
     using lox::tokenizer::tokenize;
 
-    using std::dynamic_pointer_cast;
-    using std::enable_shared_from_this;
     using std::exception;
     using std::make_shared;
     using std::runtime_error;
     using std::shared_ptr;
-    using std::stack;
     using std::string;
     using std::unordered_map;
     using std::vector;
 
-    class Interpreter: public enable_shared_from_this<Interpreter>{
+    class Interpreter: public RootSource{
         vector<StmtPtr> statements;
-        EnvPtr globals, env;
-        stack<EnvPtr> previous_envs;
-        unordered_map<ExprPtr, size_t> locals;
-
-        friend VarValue for_ast::look_up_var(const shared_ptr<Interpreter>& interpreter, const string& name, const shared_ptr<ast::Expr>& expr);
-        friend void for_ast::assign_var(const shared_ptr<Interpreter>& interpreter, const string& name, const shared_ptr<ast::Expr>& expr);
-        friend size_t for_ast::get_super_dist(const shared_ptr<Interpreter>& interpreter, const shared_ptr<ast::SuperExpr>& expr);
-
-        VarValue look_up_variable(const string& name, const ExprPtr& expr);
-        void assign_var(const string& name, const ExprPtr& expr);
+        EnvPtr globals;
+        // Slots of the call frames in progress, one after the other. The current frame starts at 'frame_base'.
+        // Top-level code runs in the first frame.
+        vector<VarValue> frame_slots;
+        size_t frame_base = 0;
+        // Lowest address the native stack may reach before a call is refused. Every Lox call recurses in native code,
+        // so the limit comes from the size of the native stack rather than from a number of frames.
+        uintptr_t stack_limit;
+        const vector<UpvaluePtr>* upvalues = nullptr;  // Upvalues of the running function, if any.
+        vector<UpvaluePtr> open_upvalues;  // Sorted by slot, so that the ones to close are at the back.
+
+        friend VarValue for_ast::look_up_var(Interpreter& interpreter, const VarLocation& location);
+        friend void for_ast::assign_var(Interpreter& interpreter, const VarLocation& location, VarValue value);
+        friend void for_ast::define_var(Interpreter& interpreter, const VarLocation& location, VarValue value);
+
+        VarValue look_up_variable(const VarLocation& location);
+        void assign_var(const VarLocation& location, VarValue value);
+        void define_var(const VarLocation& location, VarValue value);
         void define_builtins();
 
         public:
-            explicit Interpreter(const string& file_contents);
-            explicit Interpreter(const vector<StmtPtr>& statements);
+            // Native stack kept free below the limit, for the deepest call that can be made between two Lox calls
+            // and for reporting the error.
+            static constexpr size_t STACK_MARGIN = 256 * 1024;
+
+            // 'frame_size' is the number of slots the resolver gave to the variables of top-level blocks.
+            explicit Interpreter(const vector<StmtPtr>& statements, size_t frame_size = 0);
+            ~Interpreter() override;
 
-            [[nodiscard]] shared_ptr<Environment> get_globals() const{
+            [[nodiscard]] Ref<Environment> get_globals() const{
                 return globals;
             }
 
-            [[nodiscard]] shared_ptr<Environment> get_current_env() const{
-                return env;
+            // Reserves the slots of a new call frame, and returns the base of the previous one so it can be restored.
+            size_t push_frame(size_t size){
+                char marker;
+                if (reinterpret_cast<uintptr_t>(&marker) < stack_limit){
+                    throw runtime_error("Stack overflow.");
+                }
+                size_t previous_base = frame_base;
+                frame_base = frame_slots.size();
+                frame_slots.resize(frame_base + size);
+                return previous_base;
             }
 
-            void set_current_env(const shared_ptr<Environment>& new_env){
-                previous_envs.push(env);
-                env = new_env;
+            void pop_frame(size_t previous_base){
+                close_upvalues(0);
+                frame_slots.resize(frame_base);
+                frame_base = previous_base;
             }
 
-            void return_to_previous_env(){
-                if (previous_envs.empty()){
-                    return;
-                }
-                env = previous_envs.top();
-                previous_envs.pop();
+            void set_frame_slot(size_t slot, VarValue value){
+                frame_slots[frame_base + slot] = std::move(value);
             }
 
-            void resolve(const ExprPtr& expr, size_t depth){
-                locals.insert_or_assign(expr, depth);
+            // Makes the given upvalues those of the running function, and returns the previous ones.
+            const vector<UpvaluePtr>* set_upvalues(const vector<UpvaluePtr>* new_upvalues){
+                const vector<UpvaluePtr>* previous = upvalues;
+                upvalues = new_upvalues;
+                return previous;
             }
 
-            void add_nesting_level(){
-                env = make_shared<Environment>(env);
+            [[nodiscard]] const UpvaluePtr& get_upvalue(size_t index) const{
+                return (*upvalues)[index];
             }
 
-            void remove_nesting_level(){
-                if (env->get_enclosing() == nullptr){
-                    return;
-                }
-                env = env->get_enclosing();
-            }
+            // Returns the upvalue referring to the given slot of the current frame.
+            [[nodiscard]] UpvaluePtr capture_upvalue(size_t slot);
+
+            // Closes the upvalues referring to the given slot of the current frame or to the slots after it.
+            void close_upvalues(size_t slot);
+
+            void trace_roots(Tracer& tracer) const final;
 
             void run();
     };
 
-    void run(const string& file_contents);
-
     namespace for_ast{
-        VarValue look_up_var(const shared_ptr<Interpreter>& interpreter, const string& name, const ExprPtr& expr);
+        VarValue look_up_var(Interpreter& interpreter, const VarLocation& location);
+
+        void assign_var(Interpreter& interpreter, const VarLocation& location, VarValue value);
 
-        void assign_var(const shared_ptr<Interpreter>& interpreter, const string& name, const ExprPtr& expr);
+        void define_var(Interpreter& interpreter, const VarLocation& location, VarValue value);
 
-        size_t get_super_dist(const shared_ptr<Interpreter>& interpreter, const shared_ptr<ast::SuperExpr>& expr);
+        size_t push_frame(Interpreter& interpreter, size_t size);
 
-        void set_current_env(const shared_ptr<Interpreter>& interpreter, const EnvPtr& env);
+        void pop_frame(Interpreter& interpreter, size_t previous_base);
 
-        void return_to_previous_env(const shared_ptr<Interpreter>& interpreter);
+        void set_frame_slot(Interpreter& interpreter, size_t slot, VarValue value);
 
-        EnvPtr get_current_env(const shared_ptr<Interpreter>& interpreter);
+        const vector<UpvaluePtr>* set_upvalues(Interpreter& interpreter, const vector<UpvaluePtr>* upvalues);
 
-        void add_nesting_level(const shared_ptr<Interpreter>& interpreter);
+        UpvaluePtr get_upvalue(Interpreter& interpreter, size_t index);
 
-        void remove_nesting_level(const shared_ptr<Interpreter>& interpreter);
+        UpvaluePtr capture_upvalue(Interpreter& interpreter, size_t slot);
 
+        void close_upvalues(Interpreter& interpreter, size_t slot);
     }
 }
@@ -1,3 +1,6 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -6,6 +9,7 @@
 #include "parser.hpp"
 #include "interpreter.hpp"
 #include "runner.hpp"
+#include <unistd.h>
 
 // region Using directives
 using std::cout;
@@ -25,17 +29,77 @@ using namespace lox::interpreter;
 
 string read_file_contents(const string& filename);
 
+// Buffer of cout when output isn't written as it comes, writing straight to the file descriptor of the standard output.
+// Unlike the buffer of a filebuf, what it holds can be written out from a signal handler.
+class OutputBuffer: public std::streambuf{
+    char buffer[1 << 16];
+
+    protected:
+        int_type overflow(int_type c) override{
+            if (!flush()){
+                return traits_type::eof();
+            }
+            if (!traits_type::eq_int_type(c, traits_type::eof())){
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        int sync() override{
+            return flush() ? 0 : -1;
+        }
+
+    public:
+        OutputBuffer(){
+            setp(buffer, buffer + sizeof(buffer));
+        }
+
+        // Writes what the buffer holds, without emptying it.
+        [[nodiscard]] bool write_pending() const{
+            const char* data = pbase();
+            size_t size = pptr() - pbase();
+            while (size > 0){
+                ssize_t written = write(STDOUT_FILENO, data, size);
+                if (written < 0){
+                    if (errno == EINTR){
+                        continue;
+                    }
+                    return false;
+                }
+                data += written;
+                size -= written;
+            }
+            return true;
+        }
+
+        bool flush(){
+            bool written = write_pending();
+            setp(buffer, buffer + sizeof(buffer));
+            return written;
+        }
+};
+
+OutputBuffer* output_buffer = nullptr;
+
+void set_up_output(bool unbuffered);
+
+void flush_output_on_crash(int signal);
+
 int main(int argc, char *argv[]) {
-    // Disable output buffering
-    cout << unitbuf;
     cerr << unitbuf;
 
     if (argc < 3) {
-        cerr << "Usage: ./interpreter tokenize|parse|run <filename>" << endl;
+        cerr << "Usage: ./interpreter tokenize|parse|evaluate <filename>" << endl;
+        cerr << "       ./interpreter run|optimize [--engine=tree|vm] [--gc-threshold=<count>] [--unbuffered] <filename>" << endl;
         return 1;
     }
 
     const string command = argv[1];
+    // Must happen before anything is written. Only run and optimize take options, so they set it up themselves.
+    if (command != "run" && command != "optimize"){
+        set_up_output(false);
+    }
 
     if (command == "tokenize") {
         string file_contents = read_file_contents(argv[2]);
@@ -55,7 +119,8 @@ int main(int argc, char *argv[]) {
         string file_contents = read_file_contents(argv[2]);
 
         try{
-            ExprPtr expr = parse(file_contents);
+            lox::arena::Arena arena;
+            ExprPtr expr = parse(file_contents, arena);
             cout << expr->to_string() << endl;
         }
         catch (lox::parse_error& exc){
@@ -67,10 +132,44 @@ int main(int argc, char *argv[]) {
         string file_contents = read_file_contents(argv[2]);
         return lox::parser::evaluate(file_contents);
     }
-    else if (command == "run"){
-        string file_contents = read_file_contents(argv[2]);
+    else if (command == "run" || command == "optimize"){
+        // Options come between the command and the file name.
+        lox::runner::Engine engine = lox::runner::Engine::TREE_WALKER;
+        bool unbuffered = false;
+        for (int i = 2; i < argc - 1; ++i){
+            const string option = argv[i];
+            try{
+                if (option.starts_with("--engine=")){
+                    engine = lox::runner::get_engine_from_name(option.substr(9));
+                    continue;
+                }
+                if (option == "--unbuffered"){
+                    unbuffered = true;
+                    continue;
+                }
+                if (option.starts_with("--gc-threshold=")){
+                    lox::gc::Heap::get().set_threshold(lox::runner::get_gc_threshold_from_text(option.substr(15)));
+                    continue;
+                }
+            }
+            catch (const invalid_argument& exc){
+                cerr << exc.what() << endl;
+                return 1;
+            }
+            cerr << "Unknown option: " << option << endl;
+            return 1;
+        }
+
+        set_up_output(unbuffered);
+
+        string file_contents = read_file_contents(argv[argc - 1]);
         try{
-            lox::runner::run(file_contents);
+            if (command == "optimize"){
+                lox::runner::show_optimized(file_contents);
+            }
+            else{
+                lox::runner::run(file_contents, engine);
+            }
         }
         catch (const lox::parse_error& exc){
             cerr << exc.what() << endl;
@@ -88,6 +187,10 @@ int main(int argc, char *argv[]) {
             cerr << exc.what() << endl;
             return 65;
         }
+        catch (const lox::compile_error& exc){
+            cerr << exc.what() << endl;
+            return 65;
+        }
         catch (const exception& exc){
             cerr << exc.what() << endl;
             return -1;
@@ -102,6 +205,43 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
+// Printing flushes after every write only if asked to, or if a user is watching the output in a terminal.
+// Otherwise, output goes through a large buffer which is flushed at exit.
+// Error messages still come after what was printed before them, since cerr flushes cout before writing.
+void set_up_output(bool unbuffered){
+    if (unbuffered || isatty(fileno(stdout))){
+        cout << unitbuf;
+        return;
+    }
+
+    // Never freed, since cout is flushed one last time after static objects are destroyed.
+    output_buffer = new OutputBuffer();
+    cout.rdbuf(output_buffer);
+
+    // Runtime errors flush the output on their way out, but crashes would lose what is still buffered.
+    // The handler gets its own stack, since a crash may come from running out of it.
+    static char signal_stack[1 << 16];
+    stack_t stack{};
+    stack.ss_sp = signal_stack;
+    stack.ss_size = sizeof(signal_stack);
+    sigaltstack(&stack, nullptr);
+
+    struct sigaction action{};
+    action.sa_handler = flush_output_on_crash;
+    action.sa_flags = SA_ONSTACK | SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    for (int signal: {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}){
+        sigaction(signal, &action, nullptr);
+    }
+}
+
+// Only writes the pending bytes with write(2), without going through iostreams, so that it is async-signal-safe
+// whatever the program was doing when it crashed.
+void flush_output_on_crash(int signal){
+    (void) output_buffer->write_pending();
+    raise(signal);  // Delivered with the default action once the handler returns.
+}
+
 string read_file_contents(const string& filename) {
     ifstream file(filename);
     if (!file.is_open()) {
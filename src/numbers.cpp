@@ -0,0 +1,30 @@
+#include "numbers.hpp"
+#include <cmath>
+
+namespace lox::numbers{
+    // Past this, integers are displayed with an exponent rather than with all their digits.
+    static constexpr double MAX_PLAIN_INTEGER = 1e21;
+
+    string_view format_number(double number, NumberBuffer& buffer){
+        bool is_integer = std::trunc(number) == number && std::fabs(number) < MAX_PLAIN_INTEGER;
+        auto [end, error] = is_integer
+            ? std::to_chars(buffer.data(), buffer.data() + buffer.size(), number, std::chars_format::fixed)
+            : std::to_chars(buffer.data(), buffer.data() + buffer.size(), number);
+        return {buffer.data(), static_cast<size_t>(end - buffer.data())};
+    }
+
+    string_view format_number_literal(double number, NumberBuffer& buffer){
+        string_view text = format_number(number, buffer);
+        if (text.find_first_not_of("-0123456789") != string_view::npos){
+            return text;  // Already has a fractional part or an exponent, or is not finite.
+        }
+        buffer[text.size()] = '.';
+        buffer[text.size() + 1] = '0';
+        return {buffer.data(), text.size() + 2};
+    }
+
+    string number_literal_to_string(double number){
+        NumberBuffer buffer;
+        return string(format_number_literal(number, buffer));
+    }
+}
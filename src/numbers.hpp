@@ -0,0 +1,25 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace lox::numbers{
+    using std::array;
+    using std::string;
+    using std::string_view;
+
+    // Large enough for the longest representation of any double.
+    using NumberBuffer = array<char, 32>;
+
+    // Formats the number the way print displays it: integers have no fractional part,
+    // and other numbers get the fewest digits which read back as the same double.
+    // The result lives in the given buffer, so that nothing is allocated.
+    [[nodiscard]] string_view format_number(double number, NumberBuffer& buffer);
+
+    // Same as format_number, except that integers keep a fractional part, the way number literals are displayed.
+    [[nodiscard]] string_view format_number_literal(double number, NumberBuffer& buffer);
+
+    [[nodiscard]] string number_literal_to_string(double number);
+}
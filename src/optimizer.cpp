@@ -0,0 +1,326 @@
+#include "optimizer.hpp"
+
+namespace lox::optimizer{
+    static const EvalResult& get_literal_value(const ast::Expr* expr){
+        return static_cast<const ast::LiteralExpr*>(expr)->get_value();
+    }
+
+    ast::Expr* Optimizer::make_literal(const EvalResult& value){
+        using ast::LiteralExprType;
+        if (value.is_nil()){
+            return arena.make<ast::LiteralExpr>(LiteralExprType::NIL);
+        }
+        if (ast::is_boolean(value)){
+            return arena.make<ast::LiteralExpr>(ast::as_bool(value) ? LiteralExprType::TRUE : LiteralExprType::FALSE);
+        }
+        if (ast::is_number(value)){
+            return arena.make<ast::LiteralExpr>(LiteralExprType::NUMBER, lox::numbers::number_literal_to_string(ast::as_double(value)), value);
+        }
+        const string& contents = ast::as_string(value);
+        return arena.make<ast::LiteralExpr>(LiteralExprType::STRING, contents, EvalResult::intern_string(contents));
+    }
+
+    bool Optimizer::is_literal(const ast::Expr* expr){
+        return expr->get_kind() == ast::ExprKind::LITERAL;
+    }
+
+    // Whether the expression always evaluates to a boolean, in which case negating it twice gives it back.
+    bool Optimizer::produces_bool(const ast::Expr* expr){
+        using enum ast::Operator;
+        switch (expr->get_kind()){
+            case ast::ExprKind::LITERAL:
+                return ast::is_boolean(get_literal_value(expr));
+            case ast::ExprKind::UNARY:
+                return static_cast<const ast::UnaryExpr*>(expr)->get_op() == BANG;
+            case ast::ExprKind::BINARY:
+                switch (static_cast<const ast::BinaryExpr*>(expr)->get_op()){
+                    case EQUALITY:
+                    case INEQUALITY:
+                    case LESS:
+                    case GREATER:
+                    case LESS_EQUAL:
+                    case GREATER_EQUAL:
+                        return true;
+                    default:
+                        return false;
+                }
+            default:
+                return false;
+        }
+    }
+
+    // region Optimise methods for individual expression types
+    ast::Expr* Optimizer::optimize_unary_expr(ast::UnaryExpr* unary_expr){
+        unary_expr->operand = optimize(unary_expr->operand);
+        ast::Expr* operand = unary_expr->operand;
+
+        if (unary_expr->op == ast::Operator::BANG && operand->get_kind() == ast::ExprKind::UNARY){
+            auto inner = static_cast<ast::UnaryExpr*>(operand);
+            if (inner->op == ast::Operator::BANG && produces_bool(inner->operand)){
+                return inner->operand;
+            }
+        }
+
+        if (!is_literal(operand)){
+            return unary_expr;
+        }
+        const EvalResult& value = get_literal_value(operand);
+        switch (unary_expr->op){
+            case ast::Operator::BANG:
+                return make_literal(!ast::is_truthy(value));
+            case ast::Operator::MINUS:
+                if (ast::is_number(value)){
+                    return make_literal(-ast::as_double(value));
+                }
+                return unary_expr;
+            default:
+                return unary_expr;
+        }
+    }
+
+    ast::Expr* Optimizer::optimize_binary_expr(ast::BinaryExpr* bin_expr){
+        using enum ast::Operator;
+        auto as_abstract = static_cast<ast::AbstractBinaryExpr*>(bin_expr);
+        as_abstract->left = optimize(as_abstract->left);
+        as_abstract->right = optimize(as_abstract->right);
+        if (!is_literal(as_abstract->left) || !is_literal(as_abstract->right)){
+            return bin_expr;
+        }
+
+        // Only the operations which cannot fail are folded, so that errors are still reported at runtime.
+        const EvalResult& left = get_literal_value(as_abstract->left);
+        const EvalResult& right = get_literal_value(as_abstract->right);
+        if (ast::is_number(left) && ast::is_number(right)){
+            double left_num = ast::as_double(left), right_num = ast::as_double(right);
+            switch (as_abstract->op){
+                case PLUS:
+                    return make_literal(left_num + right_num);
+                case MINUS:
+                    return make_literal(left_num - right_num);
+                case STAR:
+                    return make_literal(left_num * right_num);
+                case SLASH:
+                    return make_literal(left_num / right_num);
+                case LESS:
+                    return make_literal(left_num < right_num);
+                case GREATER:
+                    return make_literal(left_num > right_num);
+                case LESS_EQUAL:
+                    return make_literal(left_num <= right_num);
+                case GREATER_EQUAL:
+                    return make_literal(left_num >= right_num);
+                case EQUALITY:
+                    return make_literal(left_num == right_num);
+                case INEQUALITY:
+                    return make_literal(left_num != right_num);
+                default:
+                    return bin_expr;
+            }
+        }
+        if (ast::is_string(left) && ast::is_string(right)){
+            switch (as_abstract->op){
+                case PLUS:
+                    return make_literal(ast::as_string(left) + ast::as_string(right));
+                case EQUALITY:
+                    return make_literal(ast::as_string(left) == ast::as_string(right));
+                case INEQUALITY:
+                    return make_literal(ast::as_string(left) != ast::as_string(right));
+                default:
+                    return bin_expr;
+            }
+        }
+        if (ast::is_boolean(left) && ast::is_boolean(right)){
+            switch (as_abstract->op){
+                case EQUALITY:
+                    return make_literal(ast::as_bool(left) == ast::as_bool(right));
+                case INEQUALITY:
+                    return make_literal(ast::as_bool(left) != ast::as_bool(right));
+                default:
+                    return bin_expr;
+            }
+        }
+        if (left.is_nil() && right.is_nil()){
+            switch (as_abstract->op){
+                case EQUALITY:
+                    return make_literal(true);
+                case INEQUALITY:
+                    return make_literal(false);
+                default:
+                    return bin_expr;
+            }
+        }
+        return bin_expr;
+    }
+
+    ast::Expr* Optimizer::optimize_logical_expr(ast::LogicalExpr* logical_expr){
+        auto as_abstract = static_cast<ast::AbstractBinaryExpr*>(logical_expr);
+        as_abstract->left = optimize(as_abstract->left);
+        as_abstract->right = optimize(as_abstract->right);
+        if (!is_literal(as_abstract->left)){
+            return logical_expr;
+        }
+
+        // A literal left operand decides which operand the expression evaluates to.
+        bool left_truthy = ast::is_truthy(get_literal_value(as_abstract->left));
+        if (as_abstract->op == ast::Operator::OR){
+            return left_truthy ? as_abstract->left : as_abstract->right;
+        }
+        return left_truthy ? as_abstract->right : as_abstract->left;
+    }
+
+    ast::Expr* Optimizer::optimize_call_expr(ast::CallExpr* call_expr){
+        call_expr->callee = optimize(call_expr->callee);
+        for (auto& arg: call_expr->args){
+            arg = optimize(arg);
+        }
+
+        // Removing parentheses around the callee can reveal a method access, which is then called without binding it.
+        ast::Expr* callee = call_expr->callee;
+        call_expr->attr_callee = callee->get_kind() == ast::ExprKind::GET_ATTR ? static_cast<ast::GetAttrExpr*>(callee) : nullptr;
+        call_expr->super_callee = callee->get_kind() == ast::ExprKind::SUPER ? static_cast<ast::SuperExpr*>(callee) : nullptr;
+        return call_expr;
+    }
+    // endregion
+
+    // region Optimise methods for individual statement types
+    ast::Statement* Optimizer::optimize_if_stmt(ast::IfStatement* if_stmt){
+        if_stmt->condition = optimize_condition(if_stmt->condition);
+        if (is_literal(if_stmt->condition)){
+            if (ast::is_truthy(get_literal_value(if_stmt->condition))){
+                return optimize(if_stmt->on_success);
+            }
+            return if_stmt->on_failure == nullptr ? nullptr : optimize(if_stmt->on_failure);
+        }
+
+        if_stmt->on_success = optimize_nested(if_stmt->on_success);
+        if (if_stmt->on_failure != nullptr){
+            if_stmt->on_failure = optimize(if_stmt->on_failure);
+        }
+        return if_stmt;
+    }
+
+    ast::Statement* Optimizer::optimize_while_stmt(ast::WhileStatement* while_stmt){
+        auto as_abstract = static_cast<ast::AbstractLogicalStmt*>(while_stmt);
+        as_abstract->condition = optimize_condition(as_abstract->condition);
+        if (is_literal(as_abstract->condition) && !ast::is_truthy(get_literal_value(as_abstract->condition))){
+            return nullptr;
+        }
+
+        as_abstract->on_success = optimize_nested(as_abstract->on_success);
+        return while_stmt;
+    }
+
+    void Optimizer::optimize_func_stmt(ast::FunctionStmt* func_stmt){
+        optimize(func_stmt->body);
+    }
+    // endregion
+
+    ast::Expr* Optimizer::optimize(ast::Expr* expr){
+        switch (expr->get_kind()){
+            case ast::ExprKind::LITERAL:
+            case ast::ExprKind::VARIABLE:
+            case ast::ExprKind::THIS:
+            case ast::ExprKind::SUPER:
+                return expr;
+            case ast::ExprKind::GROUP:
+                return optimize(static_cast<ast::GroupExpr*>(expr)->expr);
+            case ast::ExprKind::UNARY:
+                return optimize_unary_expr(static_cast<ast::UnaryExpr*>(expr));
+            case ast::ExprKind::BINARY:
+                return optimize_binary_expr(static_cast<ast::BinaryExpr*>(expr));
+            case ast::ExprKind::LOGICAL:
+                return optimize_logical_expr(static_cast<ast::LogicalExpr*>(expr));
+            case ast::ExprKind::ASSIGNMENT:{
+                auto assign_expr = static_cast<ast::AssignmentExpr*>(expr);
+                assign_expr->value = optimize(assign_expr->value);
+                return expr;
+            }
+            case ast::ExprKind::CALL:
+                return optimize_call_expr(static_cast<ast::CallExpr*>(expr));
+            case ast::ExprKind::GET_ATTR:{
+                auto get_expr = static_cast<ast::AbstractInstAccessExpr*>(expr);
+                get_expr->obj = optimize(get_expr->obj);
+                return expr;
+            }
+            case ast::ExprKind::SET_ATTR:{
+                auto set_expr = static_cast<ast::SetAttrExpr*>(expr);
+                set_expr->obj = optimize(set_expr->obj);
+                set_expr->value = optimize(set_expr->value);
+                return expr;
+            }
+        }
+        return expr;
+    }
+
+    // Conditions only need the truth of their value, so double negations can be dropped.
+    ast::Expr* Optimizer::optimize_condition(ast::Expr* expr){
+        expr = optimize(expr);
+        while (expr->get_kind() == ast::ExprKind::UNARY){
+            auto outer = static_cast<ast::UnaryExpr*>(expr);
+            if (outer->op != ast::Operator::BANG || outer->operand->get_kind() != ast::ExprKind::UNARY){
+                break;
+            }
+            auto inner = static_cast<ast::UnaryExpr*>(outer->operand);
+            if (inner->op != ast::Operator::BANG){
+                break;
+            }
+            expr = inner->operand;
+        }
+        return expr;
+    }
+
+    ast::Statement* Optimizer::optimize(ast::Statement* stmt){
+        switch (stmt->get_kind()){
+            case ast::StmtKind::EXPR:{
+                auto expr_stmt = static_cast<ast::StatementWithExpr*>(stmt);
+                expr_stmt->expr = optimize(expr_stmt->expr);
+                // A literal has no side effects, so evaluating it on its own does nothing.
+                return is_literal(expr_stmt->expr) ? nullptr : stmt;
+            }
+            case ast::StmtKind::PRINT:
+            case ast::StmtKind::VARIABLE:
+            case ast::StmtKind::RETURN:{
+                auto swe_stmt = static_cast<ast::StatementWithExpr*>(stmt);
+                if (swe_stmt->expr != nullptr){
+                    swe_stmt->expr = optimize(swe_stmt->expr);
+                }
+                return stmt;
+            }
+            case ast::StmtKind::BLOCK:{
+                auto block_stmt = static_cast<ast::BlockStatement*>(stmt);
+                optimize(block_stmt->statements);
+                return block_stmt->statements.empty() ? nullptr : stmt;
+            }
+            case ast::StmtKind::IF:
+                return optimize_if_stmt(static_cast<ast::IfStatement*>(stmt));
+            case ast::StmtKind::WHILE:
+                return optimize_while_stmt(static_cast<ast::WhileStatement*>(stmt));
+            case ast::StmtKind::FUNCTION:
+                optimize_func_stmt(static_cast<ast::FunctionStmt*>(stmt));
+                return stmt;
+            case ast::StmtKind::CLASS:
+                for (const auto& meth: static_cast<ast::ClassStmt*>(stmt)->get_meths()){
+                    optimize_func_stmt(meth);
+                }
+                return stmt;
+        }
+        return stmt;
+    }
+
+    ast::Statement* Optimizer::optimize_nested(ast::Statement* stmt){
+        ast::Statement* optimized = optimize(stmt);
+        if (optimized != nullptr){
+            return optimized;
+        }
+        auto empty = arena.make<ast::BlockStatement>(vector<ast::Statement*>{});
+        empty->set_closes_upvalues(false);
+        return empty;
+    }
+
+    void Optimizer::optimize(vector<ast::Statement*>& statements){
+        for (auto& stmt: statements){
+            stmt = optimize(stmt);
+        }
+        std::erase(statements, nullptr);
+    }
+}
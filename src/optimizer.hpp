@@ -0,0 +1,56 @@
+#pragma once
+#include "arena.hpp"
+#include "ast.hpp"
+#include <string>
+#include <vector>
+
+namespace lox::optimizer{
+    using lox::arena::Arena;
+    using lox::callable::EvalResult;
+
+    using std::string;
+    using std::vector;
+
+    // Rewrites a resolved syntax tree so that it does less work at runtime:
+    // - operations on literals are replaced with their result,
+    // - grouping parentheses are removed,
+    // - '!!x' is reduced to 'x' where only the truth of 'x' matters,
+    // - branches and loops whose condition is a literal are replaced with the code which actually runs.
+    // It runs after the resolver, so that code which gets removed is still checked for errors.
+    // Anything which could fail at runtime (such as adding a number to a string) is left as is.
+    class Optimizer{
+        Arena& arena;
+
+        [[nodiscard]] ast::Expr* make_literal(const EvalResult& value);
+
+        [[nodiscard]] static bool is_literal(const ast::Expr* expr);
+        [[nodiscard]] static bool produces_bool(const ast::Expr* expr);
+
+        // region Optimise methods for individual expression types
+        [[nodiscard]] ast::Expr* optimize_unary_expr(ast::UnaryExpr* unary_expr);
+        [[nodiscard]] ast::Expr* optimize_binary_expr(ast::BinaryExpr* bin_expr);
+        [[nodiscard]] ast::Expr* optimize_logical_expr(ast::LogicalExpr* logical_expr);
+        [[nodiscard]] ast::Expr* optimize_call_expr(ast::CallExpr* call_expr);
+        // endregion
+
+        // region Optimise methods for individual statement types
+        [[nodiscard]] ast::Statement* optimize_if_stmt(ast::IfStatement* if_stmt);
+        [[nodiscard]] ast::Statement* optimize_while_stmt(ast::WhileStatement* while_stmt);
+        void optimize_func_stmt(ast::FunctionStmt* func_stmt);
+        // endregion
+
+        [[nodiscard]] ast::Expr* optimize(ast::Expr* expr);
+        [[nodiscard]] ast::Expr* optimize_condition(ast::Expr* expr);
+
+        // Returns nullptr when the statement has nothing left to do.
+        [[nodiscard]] ast::Statement* optimize(ast::Statement* stmt);
+        // Never returns nullptr, for statements which must stay in place, such as the body of a loop.
+        [[nodiscard]] ast::Statement* optimize_nested(ast::Statement* stmt);
+
+        public:
+            // New nodes are allocated in the arena which holds the tree.
+            explicit Optimizer(Arena& arena): arena(arena){}
+
+            void optimize(vector<ast::Statement*>& statements);
+    };
+}
@@ -3,11 +3,12 @@
 //
 
 #include "parser.hpp"
+#include "interpreter.hpp"
 
 
 namespace lox::parser{
     // region Parser
-    Parser::Parser(vector<Token> token_vec): tokens(std::move(token_vec)){}
+    Parser::Parser(vector<Token> token_vec, Arena& arena): tokens(std::move(token_vec)), arena(arena){}
 
     Token& Parser::advance(){
         if (!is_at_end()){
@@ -41,43 +42,49 @@ namespace lox::parser{
         using enum TokenType;
         using ast::LiteralExprType;
         if (match(FALSE)){
-            return make_shared<ast::LiteralExpr>(LiteralExprType::FALSE);
+            return arena.make<ast::LiteralExpr>(LiteralExprType::FALSE);
         }
         if (match(TRUE)){
-            return make_shared<ast::LiteralExpr>(LiteralExprType::TRUE);
+            return arena.make<ast::LiteralExpr>(LiteralExprType::TRUE);
         }
         if (match(NIL)){
-            return make_shared<ast::LiteralExpr>(LiteralExprType::NIL);
+            return arena.make<ast::LiteralExpr>(LiteralExprType::NIL);
         }
 
         if (match(SUPER)){
             Token kw = previous();
             consume(DOT, "Expected '.' after super keyword.");
             Token meth = consume(IDENTIFIER, "Expected superclass method name.");
-            return make_shared<ast::SuperExpr>(kw, meth);
+            return arena.make<ast::SuperExpr>(kw, meth);
         }
 
         if (match(THIS)){
-            return make_shared<ast::ThisExpr>(previous());
+            return arena.make<ast::ThisExpr>(previous());
         }
 
         if (match(IDENTIFIER)){
-            return make_shared<ast::VariableExpr>(previous());
+            return arena.make<ast::VariableExpr>(previous());
         }
 
-        if (match({NUMBER, STRING})){
-            return make_shared<ast::LiteralExpr>(
-                    get_litexpr_tp_from_token_type(
-                        previous().get_token_type()
-                    ),
-                    previous().get_literal_formatted_value()
+        if (match(NUMBER)){
+            // The tokenizer already decoded the number, so it is never parsed from text again.
+            const Token& number = previous();
+            return arena.make<ast::LiteralExpr>(
+                    LiteralExprType::NUMBER,
+                    number.get_literal_formatted_value(),
+                    number.get_number_value()
             );
         }
 
+        if (match(STRING)){
+            string contents = previous().get_literal_formatted_value();
+            return arena.make<ast::LiteralExpr>(LiteralExprType::STRING, contents, EvalResult::intern_string(contents));
+        }
+
         if (match(LEFT_PAREN)){
             ExprPtr ptr = get_expr();
             consume(RIGHT_PAREN, "Expected ')' after expression.");
-            return make_shared<ast::GroupExpr>(ptr);
+            return arena.make<ast::GroupExpr>(ptr);
         }
 
         throw parse_error(65, "There is no literal to parse.");
@@ -98,7 +105,7 @@ namespace lox::parser{
 
         consume(RIGHT_PAREN, "Expected ')' after arguments.");
 
-        return make_shared<ast::CallExpr>(
+        return arena.make<ast::CallExpr>(
             callee,
             args
         );
@@ -114,7 +121,7 @@ namespace lox::parser{
             }
             else if (match(DOT)){
                 Token name = consume(IDENTIFIER, "Expected property name after '.'.");
-                expr = make_shared<ast::GetAttrExpr>(expr, name);
+                expr = arena.make<ast::GetAttrExpr>(expr, name);
             }
             else{
                 break;
@@ -128,7 +135,7 @@ namespace lox::parser{
         if (match({BANG, MINUS})){
             Token& op = previous();
             ExprPtr operand = get_unary();
-            return make_shared<ast::UnaryExpr>(
+            return arena.make<ast::UnaryExpr>(
                 get_op_from_token(op.get_token_type()),
                 operand
             );
@@ -144,7 +151,7 @@ namespace lox::parser{
         while (match({SLASH, STAR})){
             Token& oper = previous();
             ExprPtr right = get_unary();
-            expr = make_shared<ast::BinaryExpr>(
+            expr = arena.make<ast::BinaryExpr>(
                     expr,
                     get_op_from_token(oper.get_token_type()),
                     right
@@ -161,7 +168,7 @@ namespace lox::parser{
         while (match({MINUS, PLUS})){
             Token& op = previous();
             ExprPtr right = get_factor();
-            expr = make_shared<ast::BinaryExpr>(
+            expr = arena.make<ast::BinaryExpr>(
                 expr,
                 get_op_from_token(op.get_token_type()),
                 right
@@ -179,7 +186,7 @@ namespace lox::parser{
             Token& oper = previous();
             try{
                 ExprPtr right = get_term();
-                expr = make_shared<ast::BinaryExpr>(
+                expr = arena.make<ast::BinaryExpr>(
                     expr,
                     get_op_from_token(oper.get_token_type()),
                     right
@@ -201,7 +208,7 @@ namespace lox::parser{
             Token& oper = previous();
             try{
                 ExprPtr right = get_comparison();
-                expr = make_shared<ast::BinaryExpr>(
+                expr = arena.make<ast::BinaryExpr>(
                     expr,
                     get_op_from_token(oper.get_token_type()),
                     right
@@ -222,10 +229,10 @@ namespace lox::parser{
         while (match(TokenType::AND)){
             Token& op = previous();
             ExprPtr right = get_equality();
-            expr = make_shared<ast::LogicalExpr>(
-                std::move(expr),
+            expr = arena.make<ast::LogicalExpr>(
+                expr,
                 get_op_from_token(op.get_token_type()),
-                std::move(right)
+                right
             );
         }
 
@@ -238,10 +245,10 @@ namespace lox::parser{
         while (match(TokenType::OR)){
             Token& op = previous();
             ExprPtr right = get_and();
-            expr = make_shared<ast::LogicalExpr>(
-                std::move(expr),
+            expr = arena.make<ast::LogicalExpr>(
+                expr,
                 get_op_from_token(op.get_token_type()),
-                std::move(right)
+                right
             );
         }
 
@@ -256,21 +263,22 @@ namespace lox::parser{
             Token& equals = previous();
             ExprPtr value = get_assignment();
 
-            auto as_var_expr = dynamic_pointer_cast<VariableExpr>(expr);
-            if (as_var_expr != nullptr){
-                return make_shared<ast::AssignmentExpr>(
-                    as_var_expr->get_name(),
-                    value
-                );
-            }
-            auto as_get_attr = dynamic_pointer_cast<ast::GetAttrExpr>(expr);
-            if (as_get_attr != nullptr){
-                ExprPtr obj = as_get_attr->get_obj();
-                return make_shared<ast::SetAttrExpr>(
-                    obj,
-                    as_get_attr->get_attr_token(),
-                    value
-                );
+            switch (expr->get_kind()){
+                case ast::ExprKind::VARIABLE:
+                    return arena.make<ast::AssignmentExpr>(
+                        static_cast<VariableExpr*>(expr)->get_name(),
+                        value
+                    );
+                case ast::ExprKind::GET_ATTR:{
+                    auto as_get_attr = static_cast<ast::GetAttrExpr*>(expr);
+                    return arena.make<ast::SetAttrExpr>(
+                        as_get_attr->get_obj(),
+                        as_get_attr->get_attr_token(),
+                        value
+                    );
+                }
+                default:
+                    break;
             }
 
             throw parse_error(65, "Invalid assignment target.");
@@ -296,7 +304,7 @@ namespace lox::parser{
     StmtPtr Parser::get_print_statement(){
         ExprPtr val = get_expr();
         consume(TokenType::SEMICOLON, "Expected ';' after value.");
-        return make_shared<ast::PrintStatement>(
+        return arena.make<ast::PrintStatement>(
             val
         );
     }
@@ -304,7 +312,7 @@ namespace lox::parser{
     StmtPtr Parser::get_expr_statement(){
         ExprPtr val = get_expr();
         consume(TokenType::SEMICOLON, "Expected ';' after expression.");
-        return make_shared<ast::ExprStatement>(val);
+        return arena.make<ast::ExprStatement>(val);
     }
 
     vector<StmtPtr> Parser::get_block_stmt(){  // NOLINT
@@ -323,7 +331,7 @@ namespace lox::parser{
         consume(TokenType::RIGHT_PAREN, "Expected ')' after condition.");
         StmtPtr body = get_statement();
 
-        return make_shared<ast::WhileStatement>(
+        return arena.make<ast::WhileStatement>(
             condition,
             body
         );
@@ -336,7 +344,7 @@ namespace lox::parser{
         }
 
         consume(TokenType::SEMICOLON, "Expected ';' after return value.");
-        return make_shared<ast::ReturnStmt>(
+        return arena.make<ast::ReturnStmt>(
             val
         );
     }
@@ -351,14 +359,14 @@ namespace lox::parser{
         StmtPtr failure_branch = nullptr;
         if (match(ELSE)){
             failure_branch = get_statement();
-            return make_shared<ast::IfStatement>(
+            return arena.make<ast::IfStatement>(
                 condition,
                 success_branch,
                 failure_branch
             );
         }
 
-        return make_shared<ast::IfStatement>(
+        return arena.make<ast::IfStatement>(
             condition,
             success_branch
         );
@@ -404,18 +412,18 @@ namespace lox::parser{
             as_block.reserve(2);
             as_block.push_back(body);
             as_block.push_back(
-                make_shared<ast::ExprStatement>(increment)
+                arena.make<ast::ExprStatement>(increment)
             );
-            body = make_shared<ast::BlockStatement>(as_block);
+            body = arena.make<ast::BlockStatement>(as_block);
         }
 
         if (condition == nullptr){
             // Consider the condition as true for the computed "while" loop if none was provided.
-            condition = make_shared<ast::LiteralExpr>(
+            condition = arena.make<ast::LiteralExpr>(
                 ast::LiteralExprType::TRUE
             );
         }
-        body = make_shared<ast::WhileStatement>(
+        body = arena.make<ast::WhileStatement>(
             condition,
             body
         );
@@ -425,7 +433,7 @@ namespace lox::parser{
             as_init_block.reserve(2);
             as_init_block.push_back(initialiser);
             as_init_block.push_back(body);
-            body = make_shared<ast::BlockStatement>(as_init_block);
+            body = arena.make<ast::BlockStatement>(as_init_block);
         }
 
         return body;
@@ -450,7 +458,7 @@ namespace lox::parser{
         }
         if (match(LEFT_BRACE)){
             try{
-                return make_shared<ast::BlockStatement>(
+                return arena.make<ast::BlockStatement>(
                     get_block_stmt()
                 );
             }
@@ -473,13 +481,13 @@ namespace lox::parser{
         }
 
         consume(TokenType::SEMICOLON, "Expected ';' after variable declaration.");
-        return make_shared<ast::VariableStatement>(
+        return arena.make<ast::VariableStatement>(
             name.get_lexeme(),
             init
         );
     }
 
-    StmtPtr Parser::get_func_decl(bool is_method){  // NOLINT
+    ast::FunctionStmt* Parser::get_func_decl(bool is_method){  // NOLINT
         using enum TokenType;
         Token name = consume(IDENTIFIER, is_method ? "Expected method name." : "Expected function name.");
         consume(LEFT_PAREN, is_method ? "Expected '(' after method name." : "Expected '(' after function name.");
@@ -501,7 +509,7 @@ namespace lox::parser{
             is_method ? "Expected '{' before method body." : "Expected '{' before function body."
         );
 
-        auto ret = make_shared<ast::FunctionStmt>(
+        auto ret = arena.make<ast::FunctionStmt>(
             name,
             args,
             get_block_stmt()
@@ -515,30 +523,21 @@ namespace lox::parser{
 
         Token name = consume(IDENTIFIER, "Expected class name.");
 
-        shared_ptr<ast::VariableExpr> super_cls = nullptr;
+        ast::VariableExpr* super_cls = nullptr;
         if (match(LESS)){
             consume(IDENTIFIER, "Expected superclass name after '<'.");
-            super_cls = make_shared<ast::VariableExpr>(previous());
+            super_cls = arena.make<ast::VariableExpr>(previous());
         }
 
         consume(LEFT_BRACE, "Expected '{' before class body.");
 
-        vector<shared_ptr<ast::FunctionStmt>> meths;
-        vector<StmtPtr> raw_meth_ptrs;
+        vector<ast::FunctionStmt*> meths;
         while (!check(RIGHT_BRACE) && !is_at_end()){
-            raw_meth_ptrs.emplace_back(get_func_decl(true));
-        }
-        meths.reserve(raw_meth_ptrs.size());
-        for (const auto& ptr: raw_meth_ptrs){
-            auto as_func_stmt = dynamic_pointer_cast<ast::FunctionStmt>(ptr);
-            if (as_func_stmt == nullptr){
-                throw parse_error(65, "CRITICAL ERROR! At least one statement in class is not a method.");
-            }
-            meths.push_back(as_func_stmt);
+            meths.push_back(get_func_decl(true));
         }
 
         consume(RIGHT_BRACE, "Expected '}' after class body.");
-        return make_shared<ast::ClassStmt>(name, super_cls, meths);
+        return arena.make<ast::ClassStmt>(name, super_cls, meths);
     }
 
     StmtPtr Parser::get_declaration(){  // NOLINT
@@ -567,16 +566,9 @@ namespace lox::parser{
     ubyte Parser::evaluate(){
         try{
             ExprPtr expr = parse_old();
-            auto result = expr->evaluate(make_shared<Environment>());
-            if (holds_alternative<double>(result)){
-                cout << as_double(result) << endl;
-            }
-            else if (holds_alternative<bool>(result)){
-                cout << (as_bool(result) ? "true" : "false") << endl;
-            }
-            else{
-                cout << as_string(result) << endl;
-            }
+            // Expressions run in the same execution context as whole programs, with no statement to execute.
+            Interpreter interpreter(vector<StmtPtr>{});
+            lox::ast::print_value(expr->evaluate(interpreter));
             return 0;
         }
         catch (const parse_error& exc){
@@ -586,10 +578,10 @@ namespace lox::parser{
     }
     // endregion
 
-    ExprPtr parse(const string& file_contents) {
+    ExprPtr parse(const string& file_contents, Arena& arena) {
         bool contains_errors = false;
 
-        Parser parser = Parser(tokenize(file_contents, &contains_errors));
+        Parser parser = Parser(tokenize(file_contents, &contains_errors), arena);
 
         try{
             ExprPtr expr = parser.parse_old();
@@ -605,7 +597,8 @@ namespace lox::parser{
         try{
             bool contains_errors = true;
 
-            Parser parser = Parser(tokenize(file_contents, &contains_errors));
+            Arena arena;
+            Parser parser = Parser(tokenize(file_contents, &contains_errors), arena);
             return parser.evaluate();
         }
         catch (const parse_error& exc){
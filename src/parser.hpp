@@ -3,6 +3,7 @@
 //
 
 #pragma once
+#include "arena.hpp"
 #include "tokenizer.hpp"
 #include "ast.hpp"
 #include "exceptions.hpp"
@@ -20,7 +21,11 @@
 
 namespace lox::parser{
     using lox::ubyte;
+    using lox::arena::Arena;
 
+    using lox::ast::as_bool;
+    using lox::ast::as_double;
+    using lox::ast::as_string;
     using lox::ast::get_litexpr_tp_from_token_type;
     using lox::ast::get_op_from_token;
     using lox::callable::EvalResult;
@@ -29,9 +34,9 @@ namespace lox::parser{
     using lox::callable::is_string;
     using lox::callable::is_boolean;
     using lox::callable::is_callable;
-    using lox::env::Environment;
+    using lox::interpreter::Interpreter;
+    using lox::value::make_obj;
 
-    using lox::tokenizer::literals::NumberLiteral;
     using lox::tokenizer::token::Token;
     using lox::tokenizer::token::TokenType;
     using lox::tokenizer::tokenize;
@@ -39,29 +44,23 @@ namespace lox::parser{
     using std::any_of;
     using std::cout;
     using std::cerr;
-    using std::dynamic_pointer_cast;
     using std::endl;
     using std::exception;
-    using std::fixed;
-    using std::get;
-    using std::holds_alternative;
     using std::initializer_list;
     using std::invalid_argument;
-    using std::make_shared;
     using std::move;
     using std::nullptr_t;
     using std::runtime_error;
-    using std::setprecision;
-    using std::shared_ptr;
-    using std::unitbuf;
 
 
-    using ExprPtr = shared_ptr<ast::Expr>;
-    using StmtPtr = shared_ptr<ast::Statement>;
+    // Syntax tree nodes are owned by the arena they were parsed into.
+    using ExprPtr = ast::Expr*;
+    using StmtPtr = ast::Statement*;
 
     class Parser{
         vector<Token> tokens;
         size_t current_idx = 0;
+        Arena& arena;
 
         [[nodiscard]] Token& peek(){
             return tokens.at(current_idx);
@@ -121,7 +120,7 @@ namespace lox::parser{
         [[nodiscard]] StmtPtr get_for_statement();
         [[nodiscard]] StmtPtr get_statement();
         [[nodiscard]] StmtPtr get_var_declaration();
-        [[nodiscard]] StmtPtr get_func_decl(bool is_method);
+        [[nodiscard]] ast::FunctionStmt* get_func_decl(bool is_method);
         [[nodiscard]] StmtPtr get_class_decl();
         [[nodiscard]] StmtPtr get_declaration();
         // endregion
@@ -134,7 +133,7 @@ namespace lox::parser{
         }
 
         public:
-            explicit Parser(vector<Token> token_vec);
+            Parser(vector<Token> token_vec, Arena& arena);
 
             ExprPtr parse_old();
             vector<StmtPtr> parse();
@@ -142,7 +141,7 @@ namespace lox::parser{
             ubyte evaluate();
     };
 
-    ExprPtr parse(const string& file_contents);
+    ExprPtr parse(const string& file_contents, Arena& arena);
 
     ubyte evaluate(const string& file_contents);
 }
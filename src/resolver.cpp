@@ -10,18 +10,37 @@ namespace lox::resolver{
     }
 
     void Resolver::finish_scope(){
+        // The slots of a finished scope can be reused by the variables declared after it.
+        functions.back().next_slot -= scope_stack.back().size();
         scope_stack.pop_back();
     }
 
-    void Resolver::declare(const string& name){
+    bool Resolver::scope_has_captured_vars() const{
+        for (const auto& [name, var]: scope_stack.back()){
+            if (var.is_captured){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    VarLocation Resolver::add_var(const string& name, bool is_defined){
+        FunctionState& state = functions.back();
+        size_t slot = state.next_slot++;
+        state.frame_size = std::max(state.frame_size, state.next_slot);
+        scope_stack.back().insert({name, {slot, is_defined}});
+        return {slot, VarStorage::FRAME};
+    }
+
+    // Returns the location of the new variable. Globals are not tracked, and are found through the symbol of their name.
+    VarLocation Resolver::declare(const string& name){
         if (scope_stack.empty()){
-            return;
+            return lox::env::global_location(name);
         }
         if (scope_stack.back().contains(name)){
             throw resolve_error("Current scope already has a variable with this name.");
         }
-
-        scope_stack.back().insert({name, false});
+        return add_var(name, false);
     }
 
     void Resolver::define(const string& name){
@@ -29,21 +48,73 @@ namespace lox::resolver{
             return;
         }
 
-        scope_stack.back().insert_or_assign(name, true);
+        scope_stack.back().at(name).is_defined = true;
+    }
+
+    // Returns the variable if it was declared by the given function, or nullptr.
+    ScopedVar* Resolver::find_in_function(size_t func_index, const string& name){
+        size_t scopes_end = func_index + 1 < functions.size() ? functions[func_index + 1].first_scope : scope_stack.size();
+        for (size_t i = scopes_end; i > functions[func_index].first_scope; --i){
+            auto found = scope_stack[i - 1].find(name);
+            if (found != scope_stack[i - 1].end()){
+                return &found->second;
+            }
+        }
+        return nullptr;
     }
 
-    void Resolver::resolve_local(const shared_ptr<ast::Expr>& expr, const string& name){
-        for (ssize_t i = scope_stack.size() - 1; i >= 0; --i){
-            if (scope_stack.at(i).contains(name)){
-                return interpreter->resolve(expr, scope_stack.size() - 1 - i);
+    size_t Resolver::add_upvalue(FunctionState& state, size_t index, bool is_local){
+        for (size_t i = 0; i < state.upvalues.size(); ++i){
+            const ast::UpvalueRef& upvalue = state.upvalues[i];
+            if (upvalue.index == index && upvalue.is_local == is_local){
+                return i;
             }
         }
+        state.upvalues.push_back({index, is_local});
+        return state.upvalues.size() - 1;
+    }
+
+    // Captures the variable from the functions enclosing the given one, and returns its upvalue index, or -1.
+    int Resolver::resolve_upvalue(size_t func_index, const string& name){  // NOLINT
+        if (func_index == 0){
+            return -1;
+        }
+
+        ScopedVar* local = find_in_function(func_index - 1, name);
+        if (local != nullptr){
+            local->is_captured = true;
+            return static_cast<int>(add_upvalue(functions[func_index], local->slot, true));
+        }
+
+        int upvalue = resolve_upvalue(func_index - 1, name);
+        if (upvalue != -1){
+            return static_cast<int>(add_upvalue(functions[func_index], upvalue, false));
+        }
+        return -1;
+    }
+
+    VarLocation Resolver::resolve_local(const string& name){
+        ScopedVar* local = find_in_function(functions.size() - 1, name);
+        if (local != nullptr){
+            return {local->slot, VarStorage::FRAME};
+        }
+        int slot = resolve_upvalue(functions.size() - 1, name);
+        if (slot != -1){
+            return {static_cast<size_t>(slot), VarStorage::UPVALUE};
+        }
+        return lox::env::global_location(name);
     }
 
-    void Resolver::resolve_func(const shared_ptr<ast::FunctionStmt>& stmt, FuncType tp){
+    void Resolver::resolve_func(ast::FunctionStmt* stmt, FuncType tp){
         FuncType enclosing = current_func;
         current_func = tp;
+        functions.push_back({scope_stack.size()});
+
         start_scope();
+        if (tp == FuncType::METHOD || tp == FuncType::INITIALISER){
+            // Methods receive the instance they are called on in their first slot, ahead of their parameters.
+            add_var("this", true);
+        }
         for (const auto& arg: stmt->get_args()){
             string arg_name = arg.get_lexeme();
             declare(arg_name);
@@ -51,36 +122,38 @@ namespace lox::resolver{
         }
         resolve(stmt->get_body());
         finish_scope();
+
+        stmt->set_frame(functions.back().frame_size, std::move(functions.back().upvalues));
+        functions.pop_back();
         current_func = enclosing;
     }
 
     // region Resolve method for individual expression types
-    void Resolver::resolve_abstract_bin_expr(const shared_ptr<ast::AbstractBinaryExpr>& bin_expr){
+    void Resolver::resolve_abstract_bin_expr(ast::AbstractBinaryExpr* bin_expr){
         resolve(bin_expr->get_left());
         resolve(bin_expr->get_right());
     }
 
-    void Resolver::resolve_var_expr(const shared_ptr<ast::VariableExpr>& var_expr){
+    void Resolver::resolve_var_expr(ast::VariableExpr* var_expr){
         if (!scope_stack.empty()){
             string var_name = var_expr->get_name();
-            if (scope_stack.back().contains(var_name) && !scope_stack.back().at(var_name))
+            if (scope_stack.back().contains(var_name) && !scope_stack.back().at(var_name).is_defined)
                 throw resolve_error("Can't read local variable in its own initialiser.\0");
         }
 
-        resolve_local(var_expr, var_expr->get_name());
+        var_expr->set_location(resolve_local(var_expr->get_name()));
     }
 
-    void Resolver::resolve_assign_expr(const shared_ptr<ast::AssignmentExpr>& assign_expr){
-        auto expr_value = assign_expr->get_value();
-        resolve(expr_value);
-        resolve_local(expr_value, assign_expr->get_name());
+    void Resolver::resolve_assign_expr(ast::AssignmentExpr* assign_expr){
+        resolve(assign_expr->get_value());
+        assign_expr->set_location(resolve_local(assign_expr->get_name()));
     }
 
-    void Resolver::resolve_unary_expr(const shared_ptr<ast::UnaryExpr>& unary_expr){
+    void Resolver::resolve_unary_expr(ast::UnaryExpr* unary_expr){
         resolve(unary_expr->get_operand());
     }
 
-    void Resolver::resolve_call_expr(const shared_ptr<ast::CallExpr>& call_expr){
+    void Resolver::resolve_call_expr(ast::CallExpr* call_expr){
         resolve(call_expr->get_callee());
 
         for (const auto& arg: call_expr->get_args()){
@@ -88,27 +161,27 @@ namespace lox::resolver{
         }
     }
 
-    void Resolver::resolve_abstract_access_expr(const shared_ptr<ast::AbstractInstAccessExpr>& abst_acc_expr){
+    void Resolver::resolve_abstract_access_expr(ast::AbstractInstAccessExpr* abst_acc_expr){
         resolve(abst_acc_expr->get_obj());
     }
 
-    void Resolver::resolve_get_expr(const shared_ptr<ast::GetAttrExpr>& get_attr_expr){
+    void Resolver::resolve_get_expr(ast::GetAttrExpr* get_attr_expr){
         resolve_abstract_access_expr(get_attr_expr);
     }
 
-    void Resolver::resolve_set_expr(const shared_ptr<ast::SetAttrExpr>& set_attr_expr){
+    void Resolver::resolve_set_expr(ast::SetAttrExpr* set_attr_expr){
         resolve(set_attr_expr->get_value());
         resolve_abstract_access_expr(set_attr_expr);
     }
 
-    void Resolver::resolve_this_expr(const shared_ptr<ast::ThisExpr>& this_expr){
+    void Resolver::resolve_this_expr(ast::ThisExpr* this_expr){
         if (current_cls == ClassType::NONE){
             throw resolve_error("Can't use 'this' outside of classes.");
         }
-        resolve_local(this_expr, "this");
+        this_expr->set_location(resolve_local("this"));
     }
 
-    void Resolver::resolve_super_expr(const shared_ptr<ast::SuperExpr>& super_expr){
+    void Resolver::resolve_super_expr(ast::SuperExpr* super_expr){
         switch (current_cls){
             case ClassType::NONE:
                 throw resolve_error("Cannot use 'super' outside of classes.");
@@ -117,18 +190,19 @@ namespace lox::resolver{
             default:
                 break;
         }
-        resolve_local(super_expr, "super");
+        super_expr->set_location(resolve_local("super"));
+        super_expr->set_this_location(resolve_local("this"));
     }
     // endregion
 
     // region Resolve methods for individual statement types
-    void Resolver::resolve_class_stmt(const shared_ptr<ast::ClassStmt>& class_stmt){
+    void Resolver::resolve_class_stmt(ast::ClassStmt* class_stmt){
         ClassType enclosing_cls = current_cls;
         current_cls = ClassType::CLASS;
 
         string cls_name = class_stmt->get_name();
 
-        declare(cls_name);
+        class_stmt->set_location(declare(cls_name));
         define(cls_name);
 
         bool has_supercls = class_stmt->has_superclass();
@@ -142,12 +216,9 @@ namespace lox::resolver{
             resolve(super_cls_expr);
 
             start_scope();
-            scope_stack.back().insert({"super", true});  // Enable access to superclass inside methods.
+            class_stmt->set_super_location(add_var("super", true));  // Enable access to superclass inside methods.
         }
 
-        start_scope();
-        scope_stack.back().insert({"this", true});  // Allow the resolver to take care of this expressions.
-
         FuncType decl = FuncType::METHOD;
         for (const auto& meth: class_stmt->get_meths()){
             if (meth->get_name() == "init"){
@@ -158,54 +229,56 @@ namespace lox::resolver{
             decl = FuncType::METHOD;
         }
 
-        finish_scope();
-
         if (has_supercls){
+            class_stmt->set_super_captured(scope_has_captured_vars());
             finish_scope();
         }
         current_cls = enclosing_cls;
     }
 
-    void Resolver::resolve_block_stmt(const shared_ptr<ast::BlockStatement>& block_stmt){
+    void Resolver::resolve_block_stmt(ast::BlockStatement* block_stmt){
+        block_stmt->set_first_slot(functions.back().next_slot);
         start_scope();
         resolve(block_stmt->get_stmts());
+        // Blocks whose variables no closure captures have nothing to do when they end.
+        block_stmt->set_closes_upvalues(scope_has_captured_vars());
         finish_scope();
     }
 
-    void Resolver::resolve_variable_stmt(const shared_ptr<ast::VariableStatement>& var_stmt){
+    void Resolver::resolve_variable_stmt(ast::VariableStatement* var_stmt){
         string var_name = var_stmt->get_name();
-        declare(var_name);
+        var_stmt->set_location(declare(var_name));
         if (var_stmt->has_initialiser()){
             resolve(var_stmt->get_initialiser());
         }
         define(var_name);
     }
 
-    void Resolver::resolve_func_stmt(const shared_ptr<ast::FunctionStmt>& func_stmt){
+    void Resolver::resolve_func_stmt(ast::FunctionStmt* func_stmt){
         string func_name = func_stmt->get_name();
-        declare(func_name);
+        func_stmt->set_location(declare(func_name));
         define(func_name);
 
         resolve_func(func_stmt, FuncType::FUNCTION);
     }
 
-    void Resolver::resolve_abstract_logical_stmt(const shared_ptr<ast::AbstractLogicalStmt>& abst_log_stmt){
+    void Resolver::resolve_abstract_logical_stmt(ast::AbstractLogicalStmt* abst_log_stmt){
         resolve(abst_log_stmt->get_condition());
         resolve(abst_log_stmt->get_success());
     }
 
-    void Resolver::resolve_if_stmt(const shared_ptr<ast::IfStatement>& if_stmt){
+    void Resolver::resolve_if_stmt(ast::IfStatement* if_stmt){
         resolve_abstract_logical_stmt(if_stmt);
         if (if_stmt->has_failure()){
             resolve(if_stmt->get_failure());
         }
     }
 
-    void Resolver::resolve_while_stmt(const shared_ptr<ast::WhileStatement>& while_stmt){
+    void Resolver::resolve_while_stmt(ast::WhileStatement* while_stmt){
         resolve_abstract_logical_stmt(while_stmt);
     }
 
-    void Resolver::resolve_ret_stmt(const shared_ptr<ast::ReturnStmt>& ret_stmt){
+    void Resolver::resolve_ret_stmt(ast::ReturnStmt* ret_stmt){
         if (current_func == FuncType::NONE){
             throw resolve_error("Cannot return from top-level code.");
         }
@@ -216,87 +289,62 @@ namespace lox::resolver{
             resolve(ret_stmt->get_expr());
     }
 
-    void Resolver::resolve_swe_stmt(const shared_ptr<ast::StatementWithExpr>& swe_ptr){
+    void Resolver::resolve_swe_stmt(ast::StatementWithExpr* swe_ptr){
         resolve(swe_ptr->get_expr());
     }
     // endregion
 
-    void Resolver::resolve(const shared_ptr<ast::Expr>& expr){
-        // Literals do not need to be resolved.
-        auto as_super = dynamic_pointer_cast<ast::SuperExpr>(expr);
-        if (as_super != nullptr){
-            return resolve_super_expr(as_super);
-        }
-        auto as_this = dynamic_pointer_cast<ast::ThisExpr>(expr);
-        if (as_this != nullptr){
-            return resolve_this_expr(as_this);
-        }
-        auto as_assign = dynamic_pointer_cast<ast::AssignmentExpr>(expr);
-        if (as_assign != nullptr){
-            return resolve_assign_expr(as_assign);
-        }
-        auto as_var_expr = dynamic_pointer_cast<ast::VariableExpr>(expr);
-        if (as_var_expr != nullptr){
-            return resolve_var_expr(as_var_expr);
-        }
-        auto as_bin_expr = dynamic_pointer_cast<ast::AbstractBinaryExpr>(expr);
-        if (as_bin_expr != nullptr){
-            return resolve_abstract_bin_expr(as_bin_expr);
-        }
-        auto as_un_expr = dynamic_pointer_cast<ast::UnaryExpr>(expr);
-        if (as_un_expr != nullptr){
-            return resolve_unary_expr(as_un_expr);
-        }
-        auto as_call_expr = dynamic_pointer_cast<ast::CallExpr>(expr);
-        if (as_call_expr != nullptr){
-            return resolve_call_expr(as_call_expr);
-        }
-        auto as_set_attr = dynamic_pointer_cast<ast::SetAttrExpr>(expr);
-        if (as_set_attr != nullptr){
-            return resolve_set_expr(as_set_attr);
-        }
-        auto as_get_attr = dynamic_pointer_cast<ast::GetAttrExpr>(expr);
-        if (as_get_attr != nullptr){
-            return resolve_get_expr(as_get_attr);
+    void Resolver::resolve(ast::Expr* expr){
+        switch (expr->get_kind()){
+            case ast::ExprKind::LITERAL:
+                return;  // Literals do not need to be resolved.
+            case ast::ExprKind::GROUP:
+                return resolve(static_cast<ast::GroupExpr*>(expr)->expr);
+            case ast::ExprKind::UNARY:
+                return resolve_unary_expr(static_cast<ast::UnaryExpr*>(expr));
+            case ast::ExprKind::BINARY:
+            case ast::ExprKind::LOGICAL:
+                return resolve_abstract_bin_expr(static_cast<ast::AbstractBinaryExpr*>(expr));
+            case ast::ExprKind::VARIABLE:
+                return resolve_var_expr(static_cast<ast::VariableExpr*>(expr));
+            case ast::ExprKind::ASSIGNMENT:
+                return resolve_assign_expr(static_cast<ast::AssignmentExpr*>(expr));
+            case ast::ExprKind::CALL:
+                return resolve_call_expr(static_cast<ast::CallExpr*>(expr));
+            case ast::ExprKind::GET_ATTR:
+                return resolve_get_expr(static_cast<ast::GetAttrExpr*>(expr));
+            case ast::ExprKind::SET_ATTR:
+                return resolve_set_expr(static_cast<ast::SetAttrExpr*>(expr));
+            case ast::ExprKind::THIS:
+                return resolve_this_expr(static_cast<ast::ThisExpr*>(expr));
+            case ast::ExprKind::SUPER:
+                return resolve_super_expr(static_cast<ast::SuperExpr*>(expr));
         }
     }
 
-    void Resolver::resolve(const shared_ptr<ast::Statement>& stmt){
-        auto as_class_stmt = dynamic_pointer_cast<ast::ClassStmt>(stmt);
-        if (as_class_stmt != nullptr){
-            return resolve_class_stmt(as_class_stmt);
-        }
-        auto as_block_stmt = dynamic_pointer_cast<ast::BlockStatement>(stmt);
-        if (as_block_stmt != nullptr){
-            return resolve_block_stmt(as_block_stmt);
-        }
-        auto as_var_stmt = dynamic_pointer_cast<ast::VariableStatement>(stmt);
-        if (as_var_stmt != nullptr){
-            return resolve_variable_stmt(as_var_stmt);
-        }
-        auto as_func_stmt = dynamic_pointer_cast<ast::FunctionStmt>(stmt);
-        if (as_func_stmt != nullptr){
-            return resolve_func_stmt(as_func_stmt);
-        }
-        auto as_if_stmt = dynamic_pointer_cast<ast::IfStatement>(stmt);
-        if (as_if_stmt != nullptr){
-            return resolve_if_stmt(as_if_stmt);
-        }
-        auto as_while_stmt = dynamic_pointer_cast<ast::WhileStatement>(stmt);
-        if (as_while_stmt != nullptr){
-            return resolve_while_stmt(as_while_stmt);
-        }
-        auto as_ret_stmt = dynamic_pointer_cast<ast::ReturnStmt>(stmt);
-        if (as_ret_stmt != nullptr){
-            return resolve_ret_stmt(as_ret_stmt);
-        }
-        auto as_swe_ptr = dynamic_pointer_cast<ast::StatementWithExpr>(stmt);
-        if (as_swe_ptr != nullptr){
-            return resolve_swe_stmt(as_swe_ptr);
+    void Resolver::resolve(ast::Statement* stmt){
+        switch (stmt->get_kind()){
+            case ast::StmtKind::EXPR:
+            case ast::StmtKind::PRINT:
+                return resolve_swe_stmt(static_cast<ast::StatementWithExpr*>(stmt));
+            case ast::StmtKind::VARIABLE:
+                return resolve_variable_stmt(static_cast<ast::VariableStatement*>(stmt));
+            case ast::StmtKind::BLOCK:
+                return resolve_block_stmt(static_cast<ast::BlockStatement*>(stmt));
+            case ast::StmtKind::IF:
+                return resolve_if_stmt(static_cast<ast::IfStatement*>(stmt));
+            case ast::StmtKind::WHILE:
+                return resolve_while_stmt(static_cast<ast::WhileStatement*>(stmt));
+            case ast::StmtKind::FUNCTION:
+                return resolve_func_stmt(static_cast<ast::FunctionStmt*>(stmt));
+            case ast::StmtKind::RETURN:
+                return resolve_ret_stmt(static_cast<ast::ReturnStmt*>(stmt));
+            case ast::StmtKind::CLASS:
+                return resolve_class_stmt(static_cast<ast::ClassStmt*>(stmt));
         }
     }
 
-    void Resolver::resolve(const vector<shared_ptr<ast::Statement>>& statements){
+    void Resolver::resolve(const vector<ast::Statement*>& statements){
         for (const auto& stmt: statements){
             resolve(stmt);
         }
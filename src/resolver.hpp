@@ -5,7 +5,7 @@
 #pragma once
 #include "ast.hpp"
 #include "exceptions.hpp"
-#include "interpreter.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <deque>
 #include <memory>
@@ -15,19 +15,31 @@
 
 // Actual declarations
 namespace lox::resolver{
-    using lox::interpreter::Interpreter;
     using lox::tokenizer::token::Token;
 
     using std::deque;
-    using std::dynamic_pointer_cast;
-    using std::enable_shared_from_this;
-    using std::make_shared;
-    using std::shared_ptr;
     using std::string;
     using std::unordered_map;
     using std::vector;
 
-    using Scope = unordered_map<string, bool>;
+    using lox::env::VarLocation;
+    using lox::env::VarStorage;
+
+    struct ScopedVar{
+        size_t slot;  // Index of the variable in its function's call frame at runtime.
+        bool is_defined;
+        bool is_captured = false;  // Whether a closure captures it, so that its scope must close upvalues on exit.
+    };
+
+    using Scope = unordered_map<string, ScopedVar>;
+
+    // Per-function resolution state. Top-level code is resolved as the outermost function.
+    struct FunctionState{
+        size_t first_scope;  // Index of the function's outermost scope in the scope stack.
+        size_t next_slot = 0;  // Frame slot given to the next declared variable.
+        size_t frame_size = 0;
+        vector<ast::UpvalueRef> upvalues{};  // Variables captured from enclosing functions.
+    };
 
     enum class FuncType: ubyte{
         NONE,
@@ -42,57 +54,67 @@ namespace lox::resolver{
         SUBCLASS
     };
 
-    class Resolver: public enable_shared_from_this<Resolver>{
-        shared_ptr<Interpreter> interpreter;
+    class Resolver{
         deque<Scope> scope_stack;
+        vector<FunctionState> functions;
         FuncType current_func;
         ClassType current_cls;
 
         void start_scope();
         void finish_scope();
+        [[nodiscard]] bool scope_has_captured_vars() const;
 
-        void declare(const string& name);
+        VarLocation declare(const string& name);
+        VarLocation add_var(const string& name, bool is_defined);
         void define(const string& name);
 
-        void resolve_local(const shared_ptr<ast::Expr>& expr, const string& name);
-        void resolve_func(const shared_ptr<ast::FunctionStmt>& stmt, FuncType tp);
+        [[nodiscard]] VarLocation resolve_local(const string& name);
+        [[nodiscard]] ScopedVar* find_in_function(size_t func_index, const string& name);
+        static size_t add_upvalue(FunctionState& state, size_t index, bool is_local);
+        [[nodiscard]] int resolve_upvalue(size_t func_index, const string& name);
+        void resolve_func(ast::FunctionStmt* stmt, FuncType tp);
 
         // region Resolve methods for individual expression types
-        void resolve_abstract_bin_expr(const shared_ptr<ast::AbstractBinaryExpr>& bin_expr);
-        void resolve_var_expr(const shared_ptr<ast::VariableExpr>& var_expr);
-        void resolve_assign_expr(const shared_ptr<ast::AssignmentExpr>& assign_expr);
-        void resolve_unary_expr(const shared_ptr<ast::UnaryExpr>& unary_expr);
-        void resolve_call_expr(const shared_ptr<ast::CallExpr>& call_expr);
-        void resolve_abstract_access_expr(const shared_ptr<ast::AbstractInstAccessExpr>& abst_acc_expr);
-        void resolve_get_expr(const shared_ptr<ast::GetAttrExpr>& get_attr_expr);
-        void resolve_set_expr(const shared_ptr<ast::SetAttrExpr>& set_attr_expr);
-        void resolve_this_expr(const shared_ptr<ast::ThisExpr>& this_expr);
-        void resolve_super_expr(const shared_ptr<ast::SuperExpr>& super_expr);
+        void resolve_abstract_bin_expr(ast::AbstractBinaryExpr* bin_expr);
+        void resolve_var_expr(ast::VariableExpr* var_expr);
+        void resolve_assign_expr(ast::AssignmentExpr* assign_expr);
+        void resolve_unary_expr(ast::UnaryExpr* unary_expr);
+        void resolve_call_expr(ast::CallExpr* call_expr);
+        void resolve_abstract_access_expr(ast::AbstractInstAccessExpr* abst_acc_expr);
+        void resolve_get_expr(ast::GetAttrExpr* get_attr_expr);
+        void resolve_set_expr(ast::SetAttrExpr* set_attr_expr);
+        void resolve_this_expr(ast::ThisExpr* this_expr);
+        void resolve_super_expr(ast::SuperExpr* super_expr);
         // endregion
 
         // region Resolve methods for individual statement types
-        void resolve_class_stmt(const shared_ptr<ast::ClassStmt>& class_stmt);
-        void resolve_block_stmt(const shared_ptr<ast::BlockStatement>& block_stmt);
-        void resolve_variable_stmt(const shared_ptr<ast::VariableStatement>& var_stmt);
-        void resolve_func_stmt(const shared_ptr<ast::FunctionStmt>& func_stmt);
-        void resolve_abstract_logical_stmt(const shared_ptr<ast::AbstractLogicalStmt>& abst_log_stmt);
-        void resolve_if_stmt(const shared_ptr<ast::IfStatement>& if_stmt);
-        void resolve_while_stmt(const shared_ptr<ast::WhileStatement>& while_stmt);
-        void resolve_ret_stmt(const shared_ptr<ast::ReturnStmt>& ret_stmt);
-        void resolve_swe_stmt(const shared_ptr<ast::StatementWithExpr>& swe_ptr);
+        void resolve_class_stmt(ast::ClassStmt* class_stmt);
+        void resolve_block_stmt(ast::BlockStatement* block_stmt);
+        void resolve_variable_stmt(ast::VariableStatement* var_stmt);
+        void resolve_func_stmt(ast::FunctionStmt* func_stmt);
+        void resolve_abstract_logical_stmt(ast::AbstractLogicalStmt* abst_log_stmt);
+        void resolve_if_stmt(ast::IfStatement* if_stmt);
+        void resolve_while_stmt(ast::WhileStatement* while_stmt);
+        void resolve_ret_stmt(ast::ReturnStmt* ret_stmt);
+        void resolve_swe_stmt(ast::StatementWithExpr* swe_ptr);
         // endregion
 
-        void resolve(const shared_ptr<ast::Expr>& expr);
-        void resolve(const shared_ptr<ast::Statement>& stmt);
+        void resolve(ast::Expr* expr);
+        void resolve(ast::Statement* stmt);
 
         public:
-            explicit Resolver(const shared_ptr<Interpreter>& interpreter): interpreter(interpreter){
+            Resolver(){
                 current_func = FuncType::NONE;
                 current_cls = ClassType::NONE;
+                functions.push_back({0});
             }
 
-            void resolve(const vector<shared_ptr<ast::Statement>>& statements);
+            void resolve(const vector<ast::Statement*>& statements);
 
+            // Number of frame slots needed by the variables of top-level blocks.
+            [[nodiscard]] size_t get_script_frame_size() const{
+                return functions.front().frame_size;
+            }
 
     };
 }
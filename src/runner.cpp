@@ -5,17 +5,63 @@
 #include "runner.hpp"
 
 namespace lox::runner{
+    Engine get_engine_from_name(const string& name){
+        if (name == "tree"){
+            return Engine::TREE_WALKER;
+        }
+        if (name == "vm"){
+            return Engine::VM;
+        }
+        throw invalid_argument("Unknown engine: " + name);
+    }
+
+    size_t get_gc_threshold_from_text(const string& text){
+        size_t threshold = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), threshold);
+        if (error != std::errc() || end != text.data() + text.size() || threshold == 0){
+            throw invalid_argument("Invalid GC threshold: " + text);
+        }
+        return threshold;
+    }
+
     // No need to constantly check for errors, since exceptions are thrown if parsing, running or resolving fail.
-    void run(const string& file_contents){
+    void run(const string& file_contents, Engine engine){
         bool contains_errors = false;
-        Parser parser = Parser(tokenize(file_contents, &contains_errors));
+        Arena arena;  // Owns the syntax tree until the program is done running.
+        Parser parser = Parser(tokenize(file_contents, &contains_errors), arena);
+
+        vector<ast::Statement*> statements = parser.parse();
 
-        vector<shared_ptr<ast::Statement>> statements = parser.parse();
-        shared_ptr<Interpreter> interpreter = make_shared<Interpreter>(statements);
+        // Stores the slot of every local variable in the tree. The VM's compiler resolves variables by itself,
+        // but still relies on the resolver for static checks.
+        Resolver resolver;
+        resolver.resolve(statements);
+        Optimizer(arena).optimize(statements);
+
+        if (engine == Engine::VM){
+            VM vm;
+            vm.interpret(statements);
+        }
+        else{
+            Interpreter interpreter(statements, resolver.get_script_frame_size());
+            interpreter.run();
+        }
+
+        // The engine is gone, so cycles which were still reachable when the program ended are garbage now.
+        lox::gc::Heap::get().collect();
+    }
+
+    void show_optimized(const string& file_contents){
+        bool contains_errors = false;
+        Arena arena;
+        Parser parser = Parser(tokenize(file_contents, &contains_errors), arena);
 
-        shared_ptr<Resolver> resolver = make_shared<Resolver>(interpreter);
-        resolver->resolve(statements);
+        vector<ast::Statement*> statements = parser.parse();
+        Resolver().resolve(statements);
+        Optimizer(arena).optimize(statements);
 
-        interpreter->run();
+        for (const auto& stmt: statements){
+            cout << stmt->to_string() << endl;
+        }
     }
 }
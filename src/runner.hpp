@@ -3,22 +3,44 @@
 //
 
 #pragma once
+#include "optimizer.hpp"
 #include "parser.hpp"
 #include "resolver.hpp"
 #include "interpreter.hpp"
 #include "tokenizer.hpp"
+#include "vm.hpp"
+#include <charconv>
 #include <memory>
+#include <stdexcept>
 #include <string>
 
 namespace lox::runner{
+    using lox::arena::Arena;
     using lox::interpreter::Interpreter;
+    using lox::optimizer::Optimizer;
     using lox::parser::Parser;
     using lox::resolver::Resolver;
     using lox::tokenizer::tokenize;
+    using lox::vm::VM;
 
-    using std::make_shared;
-    using std::shared_ptr;
+    using std::cout;
+    using std::endl;
+    using std::invalid_argument;
     using std::string;
 
-    void run(const string& file_contents);
+    // Execution engines available to the run command.
+    enum class Engine: ubyte{
+        TREE_WALKER,  // Reference engine, evaluating the syntax tree directly.
+        VM            // Compiles the syntax tree to bytecode first.
+    };
+
+    Engine get_engine_from_name(const string& name);
+
+    // Parses the value of the --gc-threshold option.
+    size_t get_gc_threshold_from_text(const string& text);
+
+    void run(const string& file_contents, Engine engine = Engine::TREE_WALKER);
+
+    // Displays the syntax tree of the program the way the run command executes it, after optimisation.
+    void show_optimized(const string& file_contents);
 }
@@ -0,0 +1,38 @@
+#include "shape.hpp"
+
+namespace lox::shape{
+    Shape::Shape(): Shape(std::make_shared<unordered_map<SymbolId, size_t>>(), 0){}
+
+    Shape::Shape(shared_ptr<unordered_map<SymbolId, size_t>> slots, size_t field_count)
+    : slots(std::move(slots)), field_count(field_count){
+        static uint64_t next_id = NO_ID + 1;
+        id = next_id++;
+    }
+
+    size_t Shape::find(SymbolId name) const{
+        auto found = slots->find(name);
+        if (found == slots->end() || found->second >= field_count){
+            return NOT_FOUND;
+        }
+        return found->second;
+    }
+
+    Shape* Shape::with_field(SymbolId name){
+        auto& child = transitions[name];
+        if (child == nullptr){
+            auto child_slots = slots;
+            if (slots->size() != field_count){
+                // Another child already extended the table, with fields this one must not see.
+                child_slots = std::make_shared<unordered_map<SymbolId, size_t>>();
+                for (const auto& [field, slot]: *slots){
+                    if (slot < field_count){
+                        child_slots->emplace(field, slot);
+                    }
+                }
+            }
+            child_slots->emplace(name, field_count);
+            child = unique_ptr<Shape>(new Shape(std::move(child_slots), field_count + 1));
+        }
+        return child.get();
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "symbols.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace lox::shape{
+    using lox::symbols::SymbolId;
+
+    using std::shared_ptr;
+    using std::string;
+    using std::unique_ptr;
+    using std::unordered_map;
+
+    // Layout of an instance's fields: which slot of the instance holds each field name.
+    // Instances which gained the same fields in the same order share a shape, so property access sites
+    // can remember a slot for a given shape instead of looking the name up again.
+    // Shapes form a tree rooted in their class: adding a field moves an instance to a child shape.
+    class Shape{
+        // Slots of the fields of this shape and of the shapes along the same branch, which only differ by how many
+        // of the fields they have: slots are given in order, so a shape has the fields with a slot below its count.
+        // A child shape shares the table of its parent when it is the first to extend it, so that a chain of shapes
+        // takes as much memory as its last shape alone.
+        shared_ptr<unordered_map<SymbolId, size_t>> slots;
+        size_t field_count = 0;
+        unordered_map<SymbolId, unique_ptr<Shape>> transitions;
+        uint64_t id;
+
+        Shape(shared_ptr<unordered_map<SymbolId, size_t>> slots, size_t field_count);
+
+        public:
+            static constexpr size_t NOT_FOUND = SIZE_MAX;
+            static constexpr uint64_t NO_ID = 0;
+
+            Shape();
+            Shape(const Shape&) = delete;
+            Shape& operator=(const Shape&) = delete;
+
+            // Unique for the whole run, unlike the address of the shape, which a later class may reuse once its class is freed.
+            [[nodiscard]] uint64_t get_id() const{
+                return id;
+            }
+
+            // Returns the slot holding the given field, or NOT_FOUND.
+            [[nodiscard]] size_t find(SymbolId name) const;
+
+            [[nodiscard]] size_t get_field_count() const{
+                return field_count;
+            }
+
+            // Returns the shape of an instance of this shape after adding the given field, which takes the next slot.
+            [[nodiscard]] Shape* with_field(SymbolId name);
+    };
+}
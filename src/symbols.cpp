@@ -0,0 +1,16 @@
+#include "symbols.hpp"
+
+namespace lox::symbols{
+    SymbolTable& SymbolTable::get(){
+        static SymbolTable table;
+        return table;
+    }
+
+    SymbolId SymbolTable::intern(const string& name){
+        auto [found, inserted] = ids.try_emplace(name, static_cast<SymbolId>(names.size()));
+        if (inserted){
+            names.push_back(name);
+        }
+        return found->second;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+namespace lox::symbols{
+    using std::deque;
+    using std::string;
+    using std::uint32_t;
+    using std::unordered_map;
+
+    // Small integer standing for a name, so that tables keyed by names can hash and compare integers instead.
+    using SymbolId = uint32_t;
+
+    // Interns names for the whole program. A given name always gets the same id.
+    class SymbolTable{
+        unordered_map<string, SymbolId> ids;
+        deque<string> names;  // Indexed by id. Never reallocates, so references to names stay valid.
+
+        SymbolTable() = default;
+
+        public:
+            SymbolTable(const SymbolTable&) = delete;
+            SymbolTable& operator=(const SymbolTable&) = delete;
+
+            static SymbolTable& get();
+
+            SymbolId intern(const string& name);
+
+            [[nodiscard]] const string& get_name(SymbolId id) const{
+                return names[id];
+            }
+    };
+
+    inline SymbolId intern(const string& name){
+        return SymbolTable::get().intern(name);
+    }
+
+    inline const string& get_name(SymbolId id){
+        return SymbolTable::get().get_name(id);
+    }
+}
@@ -4,106 +4,12 @@
 
 #include "tokenizer.hpp"
 
-
 namespace lox::tokenizer{
 
-    namespace literals{
-        Literal::Literal(LiteralType lit, const string& orig_val){
-            lit_type = lit;
-            this->orig_val = orig_val;
-        }
-
-        string Literal::get_formatted_value() const{
-            return orig_val;
-        }
-
-        NullLiteral::NullLiteral(): Literal(LiteralType::NULL_LITERAL, ""){}
-
-        string NullLiteral::get_formatted_value() const{
-            return "null";
-        }
-
-        StringLiteral::StringLiteral(const string& orig_val): Literal(LiteralType::STRING, orig_val){}
-
-        string StringLiteral::get_formatted_value() const{
-            return Literal::get_formatted_value();
-        }
-
-        NumberLiteral::NumberLiteral(const string& orig_val): Literal(LiteralType::NUMBER, orig_val){
-            val_as_dbl = static_cast<double>(
-                stod(orig_val)
-            );
-            string::size_type dot_pos = orig_val.find(".", 1);
-            if (dot_pos == string::npos){
-                precision = 1;
-            }
-            else{
-                string decimals = orig_val.substr(dot_pos + 1);
-                precision = 0;
-                for (size_t i = 0; i < decimals.size(); ++i){
-                    if (decimals[i] != '0'){
-                        precision = i;
-                    }
-                }
-                precision++;
-            }
-        }
-
-        string NumberLiteral::get_formatted_value() const{
-            ostringstream val_stream;
-            val_stream << fixed << setprecision(precision) << val_as_dbl;
-            return val_stream.str();
-        }
-    }
-
     namespace token{
         // region Constants
         using enum TokenType;
 
-        const unordered_map<char, TokenType> _TOKEN_TYPES{
-            {'(', LEFT_PAREN},
-            {')', RIGHT_PAREN},
-            {'{', LEFT_BRACE},
-            {'}', RIGHT_BRACE},
-            {'.', DOT},
-            {'*', STAR},
-            {'-', MINUS},
-            {'+', PLUS},
-            {';', SEMICOLON},
-            {',', COMMA},
-            {'/', SLASH},
-            {'=', EQUAL},
-            {'!', BANG},
-            {'<', LESS},
-            {'>', GREATER}
-        };
-
-        const unordered_map<char, TokenType> _COMPLEX_EQUAL_TOKENS{
-            {'=', EQUAL_EQUAL},
-            {'!', BANG_EQUAL},
-            {'<', LESS_EQUAL},
-            {'>', GREATER_EQUAL}
-        };
-
-        const unordered_map<string, TokenType> _RESERVED_KW_TOK_TYPES{
-            {"and", AND},
-            {"class", CLASS},
-            {"else", ELSE},
-            {"false", FALSE},
-            {"for", FOR},
-            {"fun", FUN},
-            {"if", IF},
-            {"nil", NIL},
-            {"or", OR},
-            {"print", PRINT},
-            {"return", RETURN},
-            {"super", SUPER},
-            {"this", THIS},
-            {"true", TRUE},
-            {"var", VAR},
-            {"while", WHILE}
-        };
-
 #           define _STR_NAME_FOR_TOKTP(tok_tp) {tok_tp, #tok_tp}
 
         const unordered_map<TokenType, string> _TOKENTP_NAMES{
@@ -149,430 +55,322 @@ namespace lox::tokenizer{
         };
 
 #           undef _STR_NAME_FOR_TOKTP
+
         // endregion
 
-        Token::Token(TokenType token_tp): token_type(token_tp){
-            literal = make_shared<literals::NullLiteral>();
-            lexeme = "";
-        }
+        Token::Token(TokenType token_tp): token_type(token_tp){}
+
+        Token::Token(TokenType token_tp, string_view lexeme): token_type(token_tp), lexeme(lexeme){}
 
-        Token::Token(TokenType token_tp, const string& lexeme): token_type(token_tp), lexeme(lexeme){
-            literal = make_shared<literals::NullLiteral>();
+        Token::Token(TokenType token_tp, string_view lexeme, LiteralType treat_as)
+        : token_type(token_tp), literal_type(treat_as), lexeme(lexeme){
+            if (treat_as == LiteralType::NUMBER){
+                // The tokenizer only produces digits with at most one dot in between, which from_chars always accepts.
+                std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), number_value);
+            }
         }
 
-        Token::Token(TokenType token_tp, const string& lexeme, LiteralType treat_as): token_type(token_tp), lexeme(lexeme){
-            switch (treat_as){
+        string Token::get_literal_formatted_value() const{
+            switch (literal_type){
                 case LiteralType::NUMBER:
-                    literal = make_shared<literals::NumberLiteral>(lexeme);
-                    break;
+                    return lox::numbers::number_literal_to_string(number_value);
                 case LiteralType::STRING:
-                    literal = make_shared<literals::StringLiteral>(lexeme);
-                    break;
+                    return lexeme;
                 default:
-                    literal = make_shared<literals::NullLiteral>();
+                    return "null";
             }
         }
 
         void Token::show_in_cli() const{
             bool is_string = (token_type == TokenType::STRING);
-            cout << _TOKENTP_NAMES.at(token_type) << (is_string ? " \"" : " ") << lexeme << (is_string ? "\" " : " ") << literal->get_formatted_value() << endl;
+            cout << _TOKENTP_NAMES.at(token_type) << (is_string ? " \"" : " ") << lexeme << (is_string ? "\" " : " ") << get_literal_formatted_value() << '\n';
         }
     }
 
     namespace priv{
+        using token::TokenType;
+        using enum TokenType;
+
         // region Constants
-        const unordered_map<char, string> _TOKEN_NAMES{
-                {'(', "LEFT_PAREN"},
-                {')', "RIGHT_PAREN"},
-                {'{', "LEFT_BRACE"},
-                {'}', "RIGHT_BRACE"},
-                {'.', "DOT"},
-                {'*', "STAR"},
-                {'-', "MINUS"},
-                {'+', "PLUS"},
-                {';', "SEMICOLON"},
-                {',', "COMMA"},
-                {'/', "SLASH"},
-                {'=', "EQUAL"},
-                {'!', "BANG"},
-                {'<', "LESS"},
-                {'>', "GREATER"}
+        // Classes a character can belong to, combined as bit flags in _CHAR_TABLE.
+        constexpr ubyte CHR_IGNORE = 1 << 0;         // Whitespace between tokens.
+        constexpr ubyte CHR_DIGIT = 1 << 1;          // Digit, in numbers and after the first character of identifiers.
+        constexpr ubyte CHR_IDENTIFIER = 1 << 2;     // Letter or underscore, which can start an identifier.
+        constexpr ubyte CHR_TOKEN = 1 << 3;          // Single character token.
+        constexpr ubyte CHR_COMPLEX_TOKEN = 1 << 4;  // Token which becomes another one when followed by an '='.
+
+        struct CharInfo{
+            ubyte classes = 0;
+            TokenType token_type = EOF_TOKEN;          // Only meaningful for tokens.
+            TokenType equal_token_type = EOF_TOKEN;    // Only meaningful for complex tokens.
         };
 
-        const unordered_set<char> _COMPLEX_TOKENS{
-                '=', '!', '<', '>'
-        };
+        using CharTable = array<CharInfo, 256>;
 
-        const unordered_set<char> _IGNORE_CHARS{
-                '\t', ' ', '\n'
-        };
-
-        const unordered_set<char> _DIGITS{
-                '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'
-        };
+        consteval CharTable make_char_table(){
+            CharTable table{};
+            for (const char c: {'\t', ' ', '\n'}){
+                table[static_cast<ubyte>(c)].classes = CHR_IGNORE;
+            }
+            for (char c = '0'; c <= '9'; ++c){
+                table[static_cast<ubyte>(c)].classes = CHR_DIGIT;
+            }
+            for (char c = 'a'; c <= 'z'; ++c){
+                table[static_cast<ubyte>(c)].classes = CHR_IDENTIFIER;
+                table[static_cast<ubyte>(c - 'a' + 'A')].classes = CHR_IDENTIFIER;
+            }
+            table[static_cast<ubyte>('_')].classes = CHR_IDENTIFIER;
+
+            const pair<char, TokenType> tokens[]{
+                {'(', LEFT_PAREN},
+                {')', RIGHT_PAREN},
+                {'{', LEFT_BRACE},
+                {'}', RIGHT_BRACE},
+                {'.', DOT},
+                {'*', STAR},
+                {'-', MINUS},
+                {'+', PLUS},
+                {';', SEMICOLON},
+                {',', COMMA},
+                {'/', SLASH},
+                {'=', EQUAL},
+                {'!', BANG},
+                {'<', LESS},
+                {'>', GREATER}
+            };
+            for (const auto& [c, token_type]: tokens){
+                table[static_cast<ubyte>(c)].classes = CHR_TOKEN;
+                table[static_cast<ubyte>(c)].token_type = token_type;
+            }
 
-        const string _IDENTIFIER_CHRS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
-
-        const auto DEFAULT_PRECISION{cout.precision()};
-
-        const unordered_map<string, string> _RESERVED_KEYWORDS{
-            {"and", "AND"},
-            {"class", "CLASS"},
-            {"else", "ELSE"},
-            {"false", "FALSE"},
-            {"for", "FOR"},
-            {"fun", "FUN"},
-            {"if", "IF"},
-            {"nil", "NIL"},
-            {"or", "OR"},
-            {"print", "PRINT"},
-            {"return", "RETURN"},
-            {"super", "SUPER"},
-            {"this", "THIS"},
-            {"true", "TRUE"},
-            {"var", "VAR"},
-            {"while", "WHILE"}
-        };
+            const pair<char, TokenType> complex_tokens[]{
+                {'=', EQUAL_EQUAL},
+                {'!', BANG_EQUAL},
+                {'<', LESS_EQUAL},
+                {'>', GREATER_EQUAL}
+            };
+            for (const auto& [c, token_type]: complex_tokens){
+                table[static_cast<ubyte>(c)].classes |= CHR_COMPLEX_TOKEN;
+                table[static_cast<ubyte>(c)].equal_token_type = token_type;
+            }
+            return table;
+        }
 
+        // Indexed by the unsigned value of a byte, so that classifying it is a single load.
+        constexpr CharTable _CHAR_TABLE = make_char_table();
         // endregion
 
+        static const CharInfo& get_char_info(const char& c){
+            return _CHAR_TABLE[static_cast<ubyte>(c)];
+        }
+
         bool is_token(const char& c){
-#if __cplusplus >= 202002L
-            return _TOKEN_NAMES.contains(c);
-#else
-            return _TOKEN_NAMES.find(c) != _TOKEN_NAMES.end();
-#endif
+            return get_char_info(c).classes & CHR_TOKEN;
         }
 
-        string get_token_name(const char& c){
-            return _TOKEN_NAMES.at(c);
+        TokenType get_token_type(const char& c){
+            return get_char_info(c).token_type;
+        }
+
+        TokenType get_equal_token_type(const char& c){
+            return get_char_info(c).equal_token_type;
         }
 
         bool is_complex_token(const char& c){
-#if __cplusplus >= 202002L
-            return _COMPLEX_TOKENS.contains(c);
-#else
-            return _COMPLEX_TOKENS.find(c) != _COMPLEX_TOKENS.end();
-#endif
+            return get_char_info(c).classes & CHR_COMPLEX_TOKEN;
         }
 
         bool is_ignore_char(const char& c){
-#if __cplusplus >= 202002L
-            return _IGNORE_CHARS.contains(c);
-#else
-            return _IGNORE_CHARS.find(c) != _IGNORE_CHARS.end();
-#endif
+            return get_char_info(c).classes & CHR_IGNORE;
         }
 
         bool is_digit(const char& c){
-#if __cplusplus >= 202002L
-            return _DIGITS.contains(c);
-#else
-            return _DIGITS.find(c) != _DIGITS.end();
-#endif
+            return get_char_info(c).classes & CHR_DIGIT;
         }
 
         bool is_identifier_char(const char& c){
-#if __cplusplus >= 202002L
-            return _IDENTIFIER_CHRS.contains(c);
-#else
-            return _IDENTIFIER_CHRS.find(c) != _IDENTIFIER_CHRS.end();
-#endif
+            return get_char_info(c).classes & CHR_IDENTIFIER;
         }
 
-        bool is_reserved_kw(const string& literal_str){
-#if __cplusplus >= 202002L
-            return _RESERVED_KEYWORDS.contains(literal_str);
-#else
-            return _RESERVED_KEYWORDS.find(literal_str) != _RESERVED_KEYWORDS.end();
-#endif
+        bool is_identifier_part(const char& c){
+            return get_char_info(c).classes & (CHR_IDENTIFIER | CHR_DIGIT);
         }
 
-        string get_kw_name(const string& literal_str){
-            return _RESERVED_KEYWORDS.at(literal_str);
+        size_t skip_digits(string_view source, size_t idx){
+            while (idx < source.size() && is_digit(source[idx])){
+                idx++;
+            }
+            return idx;
         }
 
-        void display_number(const string& number){
-            string::size_type dot_pos = number.find(".", 1);
-            if (dot_pos == string::npos){
-                cout << fixed << setprecision(1) << stod(number) << endl;
-                reset_precision();
+        TokenType get_identifier_type(string_view literal_str){
+            // Only the keyword which the first characters allow is compared with the identifier.
+            auto match = [literal_str](string_view keyword, TokenType keyword_type){
+                return literal_str == keyword ? keyword_type : IDENTIFIER;
+            };
+
+            if (literal_str.size() < 2){
+                return IDENTIFIER;
             }
-            else{
-                string decimals = number.substr(dot_pos + 1);
-                size_t actual_precision = 0;
-                for (size_t i = 0; i < decimals.size(); ++i){
-                    if (decimals[i] != '0'){
-                        actual_precision = i;
+
+            switch (literal_str[0]){
+                case 'a':
+                    return match("and", AND);
+                case 'c':
+                    return match("class", CLASS);
+                case 'e':
+                    return match("else", ELSE);
+                case 'f':
+                    switch (literal_str[1]){
+                        case 'a':
+                            return match("false", FALSE);
+                        case 'o':
+                            return match("for", FOR);
+                        case 'u':
+                            return match("fun", FUN);
+                        default:
+                            return IDENTIFIER;
                     }
-                }
-                actual_precision++;
-                cout << fixed << setprecision(static_cast<int>(actual_precision)) << stod(number) << endl;
+                case 'i':
+                    return match("if", IF);
+                case 'n':
+                    return match("nil", NIL);
+                case 'o':
+                    return match("or", OR);
+                case 'p':
+                    return match("print", PRINT);
+                case 'r':
+                    return match("return", RETURN);
+                case 's':
+                    return match("super", SUPER);
+                case 't':
+                    switch (literal_str[1]){
+                        case 'h':
+                            return match("this", THIS);
+                        case 'r':
+                            return match("true", TRUE);
+                        default:
+                            return IDENTIFIER;
+                    }
+                case 'v':
+                    return match("var", VAR);
+                case 'w':
+                    return match("while", WHILE);
+                default:
+                    return IDENTIFIER;
             }
-            reset_precision();
-        }
-
-        void reset_precision(){
-            cout << setprecision(DEFAULT_PRECISION);
         }
     }
 
+    // Scans the file with a cursor, reading each token in one go from its first character.
+    // Lexemes are slices of the file contents, so that nothing is copied before the token itself is created.
     vector<token::Token> tokenize(const string& file_contents, bool* contains_errors){
-        vector<token::Token> tokens;
-        if (file_contents.empty()){
-            tokens.emplace_back(token::TokenType::EOF_TOKEN);
-            return tokens;
-        }
+        using token::TokenType;
+        using literals::LiteralType;
 
+        vector<token::Token> tokens;
+        // Dense code averages about three characters per token. Reserving for that avoids moving every token each
+        // time the vector grows, and the pages which end up unused are never touched.
+        tokens.reserve(file_contents.size() / 3);
+        const string_view source = file_contents;
+        const size_t char_count = source.size();
         ulong line_count = 1;
-        ulong str_line_start = line_count;
-        bool equal_contained_in_op = false;
-        bool in_comment = false;
-        bool in_string = false;
-        bool in_identifier = false;
-        bool in_number = false;
-        bool got_floating_point_dot = false;
-        string literal_str{};
-        size_t idx = 0;
-        size_t char_count = file_contents.size();
         bool lexical_errors = false;
-        for (const auto& byte: file_contents){
-            if (in_comment){
-                idx++;
+        size_t idx = 0;
+        while (idx < char_count){
+            const char byte = source[idx];
+            const size_t start = idx;
+
+            // Check for tabs, spaces or line feeds, which only separate tokens.
+            if (priv::is_ignore_char(byte)){
                 if (byte == '\n'){
                     line_count++;
-                    in_comment = false;
-                }
-                continue;  // Ignore characters until next line if in a comment.
-            }
-
-            if (byte == '"'){
-                // Start reading a string literal when reaching a double quote,
-                // or finish reading it if a string literal was already being read.
-                if (!in_string){
-                    in_string = true;
-                    literal_str.clear();
-                    str_line_start = line_count;
-                }
-                else{
-                    in_string = false;
-                    tokens.emplace_back(
-                        token::TokenType::STRING,  // token_type
-                        literal_str,  // lexeme
-                        literals::LiteralType::STRING  // treat_as
-                    );
                 }
                 idx++;
                 continue;
             }
 
-            if (in_string){
-                literal_str.push_back(byte);
-                idx++;
-                continue;
-            }
-
-            // Check for comment start. If two slashes are found, immediately stop tokenising.
-            if (byte == '/'){
-                if (idx + 1 < char_count && file_contents[idx + 1] == '/'){
-                    // Comment start. Stop parsing and ignore all characters until the next line feed.
-                    in_comment = true;
+            // Check for identifiers, which may turn out to be keywords.
+            if (priv::is_identifier_char(byte)){
+                do{
                     idx++;
-                    continue;
-                }
+                } while (idx < char_count && priv::is_identifier_part(source[idx]));
+                const string_view word = source.substr(start, idx - start);
+                tokens.emplace_back(
+                    priv::get_identifier_type(word),  // token_type (either a keyword or IDENTIFIER)
+                    word  // lexeme
+                );
+                continue;
             }
 
-            // Check for identifiers.
-            if (in_identifier){
-                if (priv::is_identifier_char(byte) || priv::is_digit(byte)){
-                    // Accept either ASCII, underscores or digits after the first character of an identifier.
-                    literal_str.push_back(byte);
-                    idx++;
-                    continue;
-                }
-                else{
-                    in_identifier = false;
-                    if (priv::is_reserved_kw(literal_str)){
-                        tokens.emplace_back(
-                            token::_RESERVED_KW_TOK_TYPES.at(literal_str),  // token_type
-                            literal_str  // lexeme
-                        );
-                    }
-                    else{
-                        tokens.emplace_back(
-                                token::TokenType::IDENTIFIER,  // token_type
-                                literal_str  // lexeme
-                        );
-                    }
-                }
-            }
-            else{
-                if (!in_number){
-                    if (priv::is_identifier_char(byte)){
-                        in_identifier = true;
-                        literal_str.clear();
-                        literal_str.push_back(byte);
-                        idx++;
-                        continue;
-                    }
+            // Check for number literals. A dot is only part of the number if a digit follows it.
+            if (priv::is_digit(byte)){
+                idx = priv::skip_digits(source, idx + 1);
+                if (idx + 1 < char_count && source[idx] == '.' && priv::is_digit(source[idx + 1])){
+                    idx = priv::skip_digits(source, idx + 2);
                 }
+                tokens.emplace_back(
+                    TokenType::NUMBER,  // token_type
+                    source.substr(start, idx - start),  // lexeme
+                    LiteralType::NUMBER  // treat_as
+                );
+                continue;
             }
 
-            // Check for number literals.
-            if (in_number){
-                if (byte == '.'){  // Hit a dot.
-                    if (!got_floating_point_dot){  // It's the first dot in the literal.
-                        if (idx + 1 < char_count){  // There are other characters afterwards.
-                            if (priv::is_digit(file_contents[idx + 1])){  // The immediate next one is a digit.
-                                got_floating_point_dot = true;
-                                literal_str.push_back(byte);
-                                idx++;
-                                continue;
-                            }
-                            else{  // There are no digits after this dot.
-                                in_number = false;
-                                tokens.emplace_back(
-                                    token::TokenType::NUMBER,  // token_type
-                                    literal_str,  // lexeme
-                                    literals::LiteralType::NUMBER  // treat_as
-                                );
-                            }
-                        }
-                        else{  // There are no more characters after the dot.
-                            in_number = false;
-                            tokens.emplace_back(
-                                token::TokenType::NUMBER,  // token_type
-                                literal_str,  // lexeme
-                                literals::LiteralType::NUMBER  // treat_as
-                            );
-                        }
-                    }
-                    else{  // It's the second dot hit while reading the literal.
-                        in_number = false;
-                        tokens.emplace_back(
-                            token::TokenType::NUMBER,  // token_type
-                            literal_str,  // lexeme
-                            literals::LiteralType::NUMBER  // treat_as
-                        );
-                    }
-                }
-                else if (!priv::is_digit(byte)){  // The current character isn't a digit nor a dot.
-                    in_number = false;
-                    tokens.emplace_back(
-                        token::TokenType::NUMBER,  // token_type
-                        literal_str,  // lexeme
-                        literals::LiteralType::NUMBER  // treat_as
-                    );
-                }
-                else{  // The current character is a digit.
-                    literal_str.push_back(byte);
-                    idx++;
-                    continue;
-                }
-            }
-            else{
-                if (!in_string && !in_identifier){  // Not reading a string currently.
-                    if (priv::is_digit(byte)){  // The current character is a digit.
-                        in_number = true;
-                        got_floating_point_dot = false;
-                        literal_str.clear();
-                        literal_str.push_back(byte);
-                        idx++;
-                        continue;
-                    }
+            // Check for string literals, which extend to the next double quote, even across lines.
+            if (byte == '"'){
+                const size_t end = source.find('"', idx + 1);
+                if (end == string_view::npos){
+                    // A string literal was not terminated (still reading a string upon reaching the end of the file).
+                    cerr << "[line " << line_count << "] Error: Unterminated string." << endl;
+                    lexical_errors = true;
+                    break;
                 }
+                const string_view contents = source.substr(idx + 1, end - idx - 1);
+                line_count += std::count(contents.begin(), contents.end(), '\n');
+                tokens.emplace_back(
+                    TokenType::STRING,  // token_type
+                    contents,  // lexeme
+                    LiteralType::STRING  // treat_as
+                );
+                idx = end + 1;
+                continue;
             }
 
-            // Check for tabs or whitespace characters. If the current byte is either a space or a tab, ignore it.
-            if (priv::is_ignore_char(byte)){
-                idx++;
-                if (byte == '\n'){
-                    line_count++;
-                }
+            // Check for comments, ignoring all characters until the next line feed.
+            if (byte == '/' && idx + 1 < char_count && source[idx + 1] == '/'){
+                const size_t end = source.find('\n', idx + 2);
+                idx = (end == string_view::npos) ? char_count : end;  // The line feed itself is counted above.
                 continue;
             }
 
             if (priv::is_token(byte)){
-                // Skip tokenising the current byte if it's an equal and one of the tokens in _COMPLEX_TOKENS
-                // was found as the immediate previous character.
-                if (equal_contained_in_op){
-                    equal_contained_in_op = false;
-                    idx++;
-                    continue;
-                }
-
                 // Handling complex operators
-                if (priv::is_complex_token(byte)){
-                    if (idx + 1 < char_count && file_contents[idx + 1] == '='){
-                        // If the operator's followed by an '=', ignore it when looping on it next.
-                        equal_contained_in_op = true;
-                        string _complex_lexeme;
-                        _complex_lexeme.reserve(2);
-                        _complex_lexeme.push_back(byte);
-                        _complex_lexeme.push_back('=');
-                        tokens.emplace_back(
-                                token::_COMPLEX_EQUAL_TOKENS.at(byte),  // token_type
-                                _complex_lexeme  // lexeme
-                        );
-                        idx++;
-                        continue;
-                    }
-                }
-
-                tokens.emplace_back(
-                        token::_TOKEN_TYPES.at(byte),  // token_type
-                        string(1, byte)  // lexeme (creating a string from the single character)
-                );
-            }
-            else{
-                // Repeating the identifier checks to look for a possible identifier start immediately after a literal.
-                if (priv::is_identifier_char(byte)){
-                    in_identifier = true;
-                    literal_str.clear();
-                    literal_str.push_back(byte);
-                    idx++;
+                if (priv::is_complex_token(byte) && idx + 1 < char_count && source[idx + 1] == '='){
+                    tokens.emplace_back(
+                        priv::get_equal_token_type(byte),  // token_type
+                        source.substr(idx, 2)  // lexeme
+                    );
+                    idx += 2;
                     continue;
                 }
-                // Unrecognised token character. Show an error has occurred.
-                lexical_errors = true;
-                cerr << "[line " << line_count << "] Error: Unexpected character: " << byte << endl;
-            }
-            idx++;
-        }
-
-        if (in_number){
-            in_number = false;
-            tokens.emplace_back(
-                token::TokenType::NUMBER,  // token_type
-                literal_str,  // lexeme
-                literals::LiteralType::NUMBER  // treat_as
-            );
-        }
 
-        if (in_identifier){
-            in_identifier = false;
-            if (priv::is_reserved_kw(literal_str)){
                 tokens.emplace_back(
-                        token::_RESERVED_KW_TOK_TYPES.at(literal_str),  // token_type
-                        literal_str  // lexeme
-                );
-            }
-            else{
-                tokens.emplace_back(
-                        token::TokenType::IDENTIFIER,  // token_type
-                        literal_str  // lexeme
+                    priv::get_token_type(byte),  // token_type
+                    source.substr(idx, 1)  // lexeme
                 );
+                idx++;
+                continue;
             }
-        }
 
-        if (in_string){
-            // A string literal was not terminated (still reading a string upon reaching the end of the file).
-            cerr << "[line " << str_line_start << "] Error: Unterminated string." << endl;
+            // Unrecognised token character. Show an error has occurred.
             lexical_errors = true;
+            cerr << "[line " << line_count << "] Error: Unexpected character: " << byte << endl;
+            idx++;
         }
-        tokens.emplace_back(token::TokenType::EOF_TOKEN);
+
+        tokens.emplace_back(TokenType::EOF_TOKEN);
         (*contains_errors) = lexical_errors;
         return tokens;
     }
 }
-
@@ -3,38 +3,29 @@
 //
 
 #pragma once
+#include "numbers.hpp"
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <cstdint>
-#include <iomanip>
 #include <iostream>
-#include <memory>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace lox::tokenizer{
     using ubyte = uint8_t;
     using ulong = uint64_t;
-    using std::any_of;
+    using std::array;
     using std::cout;
     using std::cerr;
     using std::endl;
-    using std::exchange;
-    using std::exit;
-    using std::fixed;
-    using std::make_shared;
-    using std::ostringstream;
-    using std::setprecision;
-    using std::shared_ptr;
-    using std::stoi;
-    using std::stod;
+    using std::pair;
     using std::string;
-    using std::swap;
+    using std::string_view;
     using std::unordered_map;
-    using std::unordered_set;
     using std::vector;
 
     namespace literals{
@@ -43,48 +34,10 @@ namespace lox::tokenizer{
             STRING,
             NUMBER
         };
-
-        class Literal{
-            LiteralType lit_type;
-
-            protected:
-                string orig_val;
-                Literal(LiteralType lit, const string& orig_val);
-
-            public:
-                [[nodiscard]] LiteralType get_literal_type() const{
-                    return lit_type;
-                }
-
-                [[nodiscard]] virtual string get_formatted_value() const;
-        };
-
-        class NullLiteral: public Literal{
-            public:
-                NullLiteral();
-                [[nodiscard]] string get_formatted_value() const final;
-        };
-
-        class StringLiteral: public Literal{
-            public:
-                explicit StringLiteral(const string& orig_val);
-
-                [[nodiscard]] string get_formatted_value() const final;
-        };
-
-        class NumberLiteral: public Literal{
-            double val_as_dbl;
-            size_t precision;
-
-            public:
-                explicit NumberLiteral(const string& orig_val);
-                [[nodiscard]] string get_formatted_value() const final;
-        };
     }
 
     namespace token{
         using literals::LiteralType;
-        using literals::Literal;
 
         enum class TokenType: ubyte{
             LEFT_PAREN,
@@ -130,41 +83,50 @@ namespace lox::tokenizer{
 
         class Token{
             TokenType token_type;
-            string lexeme;
-            shared_ptr<Literal> literal; // Can be any of NullLiteral, StringLiteral or NumberLiteral depending on the token type.
+            LiteralType literal_type = LiteralType::NULL_LITERAL;
+            string lexeme;  // Contents without the quotes for strings.
+            double number_value = 0;  // Only meaningful for number literals.
 
             public:
-                Token(TokenType token_tp, const string& lexeme);
                 explicit Token(TokenType token_tp);
-                Token(TokenType token_tp, const string& lexeme, LiteralType treat_as);
+                Token(TokenType token_tp, string_view lexeme);
+                Token(TokenType token_tp, string_view lexeme, LiteralType treat_as);
 
                 [[nodiscard]] TokenType get_token_type() const{
                     return token_type;
                 }
 
-                [[nodiscard]] string get_lexeme() const{
+                [[nodiscard]] const string& get_lexeme() const{
                     return lexeme;
                 }
 
-                [[nodiscard]] string get_literal_formatted_value() const{
-                    return literal->get_formatted_value();
+                [[nodiscard]] LiteralType get_literal_type() const{
+                    return literal_type;
                 }
 
+                [[nodiscard]] double get_number_value() const{
+                    return number_value;
+                }
+
+                [[nodiscard]] string get_literal_formatted_value() const;
+
                 void show_in_cli() const;
         };
     }
 
     namespace priv{
         bool is_token(const char& c);
-        string get_token_name(const char& c);
         bool is_complex_token(const char& c);
         bool is_ignore_char(const char& c);
         bool is_digit(const char& c);
         bool is_identifier_char(const char& c);
-        bool is_reserved_kw(const string& literal_str);
-        string get_kw_name(const string& kw_name);
-        void display_number(const string& number);
-        void reset_precision();
+        bool is_identifier_part(const char& c);
+        // Returns the index of the first character from idx onwards which isn't a digit.
+        size_t skip_digits(string_view source, size_t idx);
+        token::TokenType get_token_type(const char& c);
+        token::TokenType get_equal_token_type(const char& c);
+        // Returns the type of the keyword spelled by literal_str, or IDENTIFIER if it isn't one.
+        token::TokenType get_identifier_type(string_view literal_str);
     }
 
     vector<token::Token> tokenize(const string& file_contents, bool* contained_errors);
@@ -0,0 +1,87 @@
+#include "value.hpp"
+#include "gc.hpp"
+#include <unordered_map>
+#include <vector>
+
+namespace lox::value{
+    Obj::Obj(ObjType type): type(type){
+        if (is_traced()){
+            Heap::get().track(this);
+        }
+    }
+
+    Obj::~Obj(){
+        if (is_traced()){
+            Heap::get().untrack(this);
+        }
+    }
+
+    LoxString::LoxString(Ref<LoxString> left, Ref<LoxString> right)
+    : Obj(ObjType::STRING), length(left->size() + right->size()), left(std::move(left)), right(std::move(right)){}
+
+    LoxString::~LoxString(){
+        if (!left){
+            return;
+        }
+        // Releasing a long chain of concatenations would otherwise recurse once per node,
+        // so the nodes nothing else refers to are taken apart one at a time.
+        std::vector<Ref<LoxString>> pending;
+        pending.push_back(std::move(left));
+        pending.push_back(std::move(right));
+        while (!pending.empty()){
+            Ref<LoxString> node = std::move(pending.back());
+            pending.pop_back();
+            if (node && node->has_single_owner()){
+                pending.push_back(std::move(node->left));
+                pending.push_back(std::move(node->right));
+            }
+        }
+    }
+
+    void LoxString::flatten() const{
+        string flat;
+        flat.reserve(length);
+        // Leaves are appended from left to right, with a stack rather than recursion for the same reason as above.
+        std::vector<const LoxString*> pending{this};
+        while (!pending.empty()){
+            const LoxString* node = pending.back();
+            pending.pop_back();
+            if (node->left){
+                pending.push_back(node->right.get());
+                pending.push_back(node->left.get());
+            }
+            else{
+                flat += node->value;
+            }
+        }
+        value = std::move(flat);
+        left = nullptr;
+        right = nullptr;
+    }
+
+    Value Value::concat_strings(const Value& left, const Value& right){
+        auto left_str = static_cast<LoxString*>(left.as_obj()), right_str = static_cast<LoxString*>(right.as_obj());
+        if (left_str->size() + right_str->size() < LoxString::MIN_ROPE_LENGTH){
+            return left_str->get() + right_str->get();
+        }
+        return make_obj<LoxString>(Ref<LoxString>(left_str), Ref<LoxString>(right_str));
+    }
+
+    bool Value::strings_equal(const Value& left, const Value& right){
+        if (left.bits == right.bits){
+            return true;
+        }
+        auto left_str = static_cast<LoxString*>(left.as_obj()), right_str = static_cast<LoxString*>(right.as_obj());
+        // Checking the lengths first also avoids flattening ropes which cannot be equal.
+        return left_str->size() == right_str->size() && left_str->get() == right_str->get();
+    }
+
+    Value Value::intern_string(const string& str){
+        static std::unordered_map<string, Value> interned;
+        auto [found, inserted] = interned.try_emplace(str);
+        if (inserted){
+            found->second = Value(str);
+        }
+        return found->second;
+    }
+}
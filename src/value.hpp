@@ -0,0 +1,352 @@
+#pragma once
+#include "utils.hpp"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Forward declarations
+namespace lox::callable{
+    class AbstractLoxCallable;
+}
+
+namespace lox::inst{
+    class LoxInstance;
+}
+
+namespace lox::gc{
+    class Heap;
+    class Tracer;
+}
+
+// Actual declarations
+namespace lox::value{
+    using lox::callable::AbstractLoxCallable;
+    using lox::gc::Heap;
+    using lox::gc::Tracer;
+    using lox::inst::LoxInstance;
+
+    using std::bit_cast;
+    using std::nullptr_t;
+    using std::string;
+    using std::uint64_t;
+
+    enum class ObjType: ubyte{
+        STRING,
+        CALLABLE,
+        INSTANCE,
+        ENVIRONMENT,  // Not a Lox value, but holds values and takes part in reference cycles.
+        UPVALUE       // Same, for variables captured by closures.
+    };
+
+    // Base class for every object living on the heap.
+    // Objects are reference counted intrusively, so handing them around never allocates a control block,
+    // and the counter is not atomic since the interpreter is single-threaded.
+    // Cycles are reclaimed by the collector in gc.hpp, which every object able to hold references registers with.
+    class Obj{
+        size_t ref_count = 0;
+        ObjType type;
+
+        // Collector bookkeeping.
+        Obj* gc_prev = nullptr;
+        Obj* gc_next = nullptr;
+        size_t gc_refs = 0;
+        bool gc_marked = false;
+
+        friend class lox::gc::Heap;
+
+        protected:
+            explicit Obj(ObjType type);
+
+        public:
+            Obj(const Obj&) = delete;
+            Obj& operator=(const Obj&) = delete;
+            virtual ~Obj();
+
+            [[nodiscard]] ObjType get_type() const{
+                return type;
+            }
+
+            // Strings cannot reference anything, so they never need to be traced.
+            [[nodiscard]] bool is_traced() const{
+                return type != ObjType::STRING;
+            }
+
+            // Reports every object this one holds a counted reference to.
+            virtual void trace(Tracer&) const{}
+
+            // Drops every reference held by this object, to break an unreachable cycle before freeing it.
+            virtual void clear_refs(){}
+
+            void retain(){
+                ++ref_count;
+            }
+
+            [[nodiscard]] bool has_single_owner() const{
+                return ref_count == 1;
+            }
+
+            void release(){
+                if (--ref_count == 0){
+                    delete this;
+                }
+            }
+    };
+
+    // Owning handle to a heap object. Mirrors the parts of shared_ptr the interpreter relies on.
+    template<class T> class Ref{
+        T* ptr = nullptr;
+
+        template<class U> friend class Ref;
+
+        public:
+            Ref() = default;
+
+            Ref(nullptr_t){}  // NOLINT: allows returning nullptr like with shared_ptr.
+
+            explicit Ref(T* raw): ptr(raw){
+                if (ptr != nullptr){
+                    ptr->retain();
+                }
+            }
+
+            Ref(const Ref& other): Ref(other.ptr){}
+
+            Ref(Ref&& other) noexcept: ptr(std::exchange(other.ptr, nullptr)){}
+
+            template<class U> Ref(const Ref<U>& other): Ref(static_cast<T*>(other.ptr)){}  // NOLINT
+
+            template<class U> Ref(Ref<U>&& other) noexcept: ptr(std::exchange(other.ptr, nullptr)){}  // NOLINT
+
+            ~Ref(){
+                if (ptr != nullptr){
+                    ptr->release();
+                }
+            }
+
+            Ref& operator=(Ref other) noexcept{
+                std::swap(ptr, other.ptr);
+                return *this;
+            }
+
+            [[nodiscard]] T* get() const{
+                return ptr;
+            }
+
+            T* operator->() const{
+                return ptr;
+            }
+
+            T& operator*() const{
+                return *ptr;
+            }
+
+            explicit operator bool() const{
+                return ptr != nullptr;
+            }
+
+            template<class U> bool operator==(const Ref<U>& other) const{
+                return ptr == other.ptr;
+            }
+
+            bool operator==(nullptr_t) const{
+                return ptr == nullptr;
+            }
+    };
+
+    template<class T, class... Args> Ref<T> make_obj(Args&&... args){
+        return Ref<T>(new T(std::forward<Args>(args)...));
+    }
+
+    template<class T, class U> Ref<T> static_obj_cast(const Ref<U>& ref){
+        return Ref<T>(static_cast<T*>(ref.get()));
+    }
+
+    // Immutable string contents. Concatenation creates a new object.
+    // Long concatenations start out as a rope node which only points to both halves, and are copied into a single
+    // string the first time their contents are read, so appending to a string in a loop takes linear time.
+    class LoxString: public Obj{
+        mutable string value;
+        size_t length;
+        mutable Ref<LoxString> left, right;  // Halves of a concatenation which was not read yet.
+
+        void flatten() const;
+
+        public:
+            // Shorter concatenations are copied right away, since a rope node would cost more than the copy.
+            static constexpr size_t MIN_ROPE_LENGTH = 64;
+
+            explicit LoxString(string value): Obj(ObjType::STRING), value(std::move(value)), length(this->value.size()){}
+
+            LoxString(Ref<LoxString> left, Ref<LoxString> right);
+
+            ~LoxString() override;
+
+            [[nodiscard]] size_t size() const{
+                return length;
+            }
+
+            [[nodiscard]] const string& get() const{
+                if (left){
+                    flatten();
+                }
+                return value;
+            }
+    };
+
+    // A Lox value, packed in 64 bits.
+    // Numbers are stored as plain doubles. Every other kind of value hides in the payload of a quiet NaN:
+    // nil and booleans are small tags, and heap objects set the sign bit and keep their address in the low 48 bits.
+    class Value{
+        static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+        static constexpr uint64_t QNAN = 0x7ffc000000000000;
+        static constexpr uint64_t CANONICAL_NAN = 0x7ff8000000000000;  // NaNs produced by arithmetic, kept out of the tagged range.
+        static constexpr uint64_t TAG_NIL = 1;
+        static constexpr uint64_t TAG_FALSE = 2;
+        static constexpr uint64_t TAG_TRUE = 3;
+        static constexpr uint64_t NIL_BITS = QNAN | TAG_NIL;
+        static constexpr uint64_t FALSE_BITS = QNAN | TAG_FALSE;
+        static constexpr uint64_t TRUE_BITS = QNAN | TAG_TRUE;
+        static constexpr uint64_t OBJ_BITS = SIGN_BIT | QNAN;
+
+        uint64_t bits = NIL_BITS;
+
+        static void retain(uint64_t val_bits){
+            if ((val_bits & OBJ_BITS) == OBJ_BITS){
+                reinterpret_cast<Obj*>(val_bits & ~OBJ_BITS)->retain();
+            }
+        }
+
+        static void release(uint64_t val_bits){
+            if ((val_bits & OBJ_BITS) == OBJ_BITS){
+                reinterpret_cast<Obj*>(val_bits & ~OBJ_BITS)->release();
+            }
+        }
+
+        explicit Value(Obj* obj): bits(OBJ_BITS | reinterpret_cast<uint64_t>(obj)){
+            obj->retain();
+        }
+
+        public:
+            Value() = default;  // nil
+
+            [[nodiscard]] static Value nil(){
+                return {};
+            }
+
+            Value(double number): bits(number == number ? bit_cast<uint64_t>(number) : CANONICAL_NAN){}  // NOLINT
+
+            Value(bool boolean): bits(boolean ? TRUE_BITS : FALSE_BITS){}  // NOLINT
+
+            Value(string str): Value(static_cast<Obj*>(new LoxString(std::move(str)))){}  // NOLINT
+
+            Value(const char* str): Value(string(str)){}  // NOLINT
+
+            template<class T> Value(const Ref<T>& ref): Value(static_cast<Obj*>(ref.get())){}  // NOLINT
+
+            Value(const Value& other): bits(other.bits){
+                retain(bits);
+            }
+
+            Value(Value&& other) noexcept: bits(std::exchange(other.bits, NIL_BITS)){}
+
+            ~Value(){
+                release(bits);
+            }
+
+            Value& operator=(const Value& other){
+                // Retain first: the object being released may own 'other'.
+                uint64_t new_bits = other.bits;
+                retain(new_bits);
+                release(bits);
+                bits = new_bits;
+                return *this;
+            }
+
+            Value& operator=(Value&& other) noexcept{
+                uint64_t new_bits = std::exchange(other.bits, NIL_BITS);
+                release(bits);
+                bits = new_bits;
+                return *this;
+            }
+
+            // region Type checks
+            [[nodiscard]] bool is_number() const{
+                return (bits & QNAN) != QNAN;
+            }
+
+            [[nodiscard]] bool is_nil() const{
+                return bits == NIL_BITS;
+            }
+
+            [[nodiscard]] bool is_bool() const{
+                return (bits | 1) == TRUE_BITS;
+            }
+
+            [[nodiscard]] bool is_obj() const{
+                return (bits & OBJ_BITS) == OBJ_BITS;
+            }
+
+            [[nodiscard]] bool is_obj_type(ObjType type) const{
+                return is_obj() && as_obj()->get_type() == type;
+            }
+
+            [[nodiscard]] bool is_string() const{
+                return is_obj_type(ObjType::STRING);
+            }
+
+            [[nodiscard]] bool is_callable() const{
+                return is_obj_type(ObjType::CALLABLE);
+            }
+
+            [[nodiscard]] bool is_instance() const{
+                return is_obj_type(ObjType::INSTANCE);
+            }
+            // endregion
+
+            // region Accessors. The value must hold the requested type.
+            [[nodiscard]] double as_number() const{
+                return bit_cast<double>(bits);
+            }
+
+            [[nodiscard]] bool as_bool() const{
+                return bits == TRUE_BITS;
+            }
+
+            [[nodiscard]] Obj* as_obj() const{
+                return reinterpret_cast<Obj*>(bits & ~OBJ_BITS);
+            }
+
+            [[nodiscard]] const string& as_string() const{
+                return static_cast<LoxString*>(as_obj())->get();
+            }
+
+            // Joins two strings, without copying them if the result is long. Both values must hold strings.
+            [[nodiscard]] static Value concat_strings(const Value& left, const Value& right);
+
+            // Compares two strings, starting with their addresses and lengths. Both values must hold strings.
+            [[nodiscard]] static bool strings_equal(const Value& left, const Value& right);
+
+            // Returns the string object shared by every string constant with these contents,
+            // so that equal constants compare by address.
+            [[nodiscard]] static Value intern_string(const string& str);
+
+            // Defined along with the classes they return.
+            [[nodiscard]] Ref<AbstractLoxCallable> as_callable() const;
+            [[nodiscard]] Ref<LoxInstance> as_instance() const;
+            // endregion
+
+            friend bool operator==(const Value& left, const Value& right){
+                if (left.is_number() && right.is_number()){
+                    return left.as_number() == right.as_number();
+                }
+                if (left.is_string() && right.is_string()){
+                    return strings_equal(left, right);
+                }
+                return left.bits == right.bits;
+            }
+    };
+
+    static_assert(sizeof(Value) == 8);
+}
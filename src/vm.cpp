@@ -0,0 +1,516 @@
+#include "vm.hpp"
+
+namespace lox::vm{
+    using lox::ast::is_truthy;
+    using lox::ast::print_value;
+    using lox::callable::is_boolean;
+    using lox::callable::is_callable;
+    using lox::callable::is_cls_inst;
+    using lox::callable::is_number;
+    using lox::callable::is_string;
+    using lox::inst::for_callable::create_inst;
+
+    namespace{
+        // Same semantics as the tree-walker's equality operator: values of different types are never equal.
+        bool values_equal(const Value& left, const Value& right){
+            if (is_number(left) && is_number(right)){
+                return left.as_number() == right.as_number();
+            }
+            if (is_boolean(left) && is_boolean(right)){
+                return left.as_bool() == right.as_bool();
+            }
+            if (is_string(left) && is_string(right)){
+                return Value::strings_equal(left, right);
+            }
+            return left.is_nil() && right.is_nil();
+        }
+
+        void check_number_operands(const Value& left, const Value& right){
+            if (!is_number(left) || !is_number(right)){
+                throw parse_error(70, "Unsupported operation.");
+            }
+        }
+
+        Value call_error(){
+            throw runtime_error("Functions compiled for the VM can only be called from the VM.");
+        }
+
+        void check_arity(ubyte expected, ubyte arg_count){
+            if (arg_count != expected){
+                throw runtime_error("Expected " + std::to_string(expected) + " arguments, got " + std::to_string(arg_count));
+            }
+        }
+    }
+
+    // region VmClosure
+    VmClosure::VmClosure(const shared_ptr<VmFunction>& function)
+    : AbstractLoxCallable(CallableKind::VM_CLOSURE), function(function){
+        upvalues.reserve(function->get_upvalue_count());
+    }
+
+    CallablePtr VmClosure::bind(const InstancePtr& inst){
+        return make_obj<VmBoundMethod>(inst, Ref<VmClosure>(this));
+    }
+
+    Value VmClosure::call(Interpreter&, const vector<Value>&){
+        return call_error();
+    }
+
+    void VmClosure::trace(Tracer& tracer) const{
+        for (const auto& upvalue: upvalues){
+            tracer.visit(upvalue);
+        }
+    }
+
+    void VmClosure::clear_refs(){
+        upvalues.clear();
+    }
+    // endregion
+
+    // region VmBoundMethod
+    Value VmBoundMethod::call(Interpreter&, const vector<Value>&){
+        return call_error();
+    }
+    // endregion
+
+    // region VM
+    VM::VM(){
+        frames.reserve(FRAMES_MAX);
+        stack.reserve(UINT8_MAX + 1);
+        define_builtins();
+        Heap::get().add_root_source(this);
+    }
+
+    VM::~VM(){
+        Heap::get().remove_root_source(this);
+    }
+
+    void VM::trace_roots(Tracer& tracer) const{
+        for (const auto& value: stack){
+            tracer.visit(value);
+        }
+        for (const auto& frame: frames){
+            tracer.visit(frame.closure);
+        }
+        for (const auto& upvalue: open_upvalues){
+            tracer.visit(upvalue);
+        }
+        for (const auto& value: globals){
+            tracer.visit(value);
+        }
+    }
+
+    void VM::define_builtin(const string& name, const CallablePtr& func){
+        uint16_t id = global_table.resolve(name);
+        globals.resize(global_table.size());
+        defined_globals.resize(global_table.size(), false);
+        globals[id] = func;
+        defined_globals[id] = true;
+    }
+
+    void VM::define_builtins(){
+        define_builtin("clock", make_obj<builtins::ClockFunc>());
+        define_builtin("cos", make_obj<builtins::CosFunc>());
+        define_builtin("sin", make_obj<builtins::SinFunc>());
+    }
+
+    void VM::call_closure(VmClosure* closure, ubyte arg_count){
+        check_arity(closure->arity(), arg_count);
+        if (frames.size() == FRAMES_MAX){
+            throw runtime_error("Stack overflow.");
+        }
+        frames.push_back({
+            closure,
+            closure->function->get_chunk().get_code().data(),
+            stack.size() - arg_count - 1
+        });
+    }
+
+    void VM::call_value(ubyte arg_count){
+        Value& callee = peek(arg_count);
+        if (!is_callable(callee)){
+            throw runtime_error("Given object is not callable.");
+        }
+        CallablePtr func = callee.as_callable();
+
+        switch (func->get_kind()){
+            case CallableKind::VM_CLOSURE:
+                return call_closure(static_cast<VmClosure*>(func.get()), arg_count);
+            case CallableKind::VM_BOUND_METHOD:{
+                auto as_bound = static_cast<VmBoundMethod*>(func.get());
+                callee = as_bound->receiver;  // Becomes 'this' in the method's slot zero.
+                return call_closure(as_bound->method.get(), arg_count);
+            }
+            case CallableKind::CLASS:{
+                auto as_cls = static_obj_cast<LoxClass>(func);
+                callee = create_inst(as_cls);
+                const CallablePtr& initialiser = as_cls->get_initialiser();
+                if (initialiser == nullptr){
+                    return check_arity(0, arg_count);
+                }
+                return call_closure(static_cast<VmClosure*>(initialiser.get()), arg_count);
+            }
+            case CallableKind::NATIVE:{
+                // Native functions do not depend on the engine, so they are called directly.
+                check_arity(func->arity(), arg_count);
+                vector<Value> args(stack.end() - arg_count, stack.end());
+                Value result = static_cast<builtins::NativeFunction*>(func.get())->call_native(args);
+                stack.resize(stack.size() - arg_count - 1);
+                push(std::move(result));
+                return;
+            }
+            default:
+                throw runtime_error("Given object is not callable.");
+        }
+    }
+
+    UpvaluePtr VM::capture_upvalue(size_t slot){
+        // Closures capturing the same variable must share the same upvalue.
+        auto it = open_upvalues.end();
+        while (it != open_upvalues.begin() && (*(it - 1))->slot >= slot){
+            --it;
+            if ((*it)->slot == slot){
+                return *it;
+            }
+        }
+        auto created = make_obj<VmUpvalue>(slot);
+        open_upvalues.insert(it, created);
+        return created;
+    }
+
+    void VM::close_upvalues(size_t last_slot){
+        while (!open_upvalues.empty() && open_upvalues.back()->slot >= last_slot){
+            UpvaluePtr& upvalue = open_upvalues.back();
+            upvalue->closed = stack[upvalue->slot];
+            upvalue->is_open = false;
+            open_upvalues.pop_back();
+        }
+    }
+
+    void VM::run(){
+        CallFrame* frame = &frames.back();
+        const ubyte* ip = frame->ip;
+        const Chunk* chunk = &frame->closure->function->get_chunk();
+
+        auto read_byte = [&ip](){
+            return *ip++;
+        };
+        auto read_short = [&ip](){
+            ip += 2;
+            return static_cast<uint16_t>((ip[-2] << 8) | ip[-1]);
+        };
+        auto read_name = [&]() -> const string&{
+            return chunk->get_constant(read_short()).as_string();
+        };
+        auto read_symbol = [&](){
+            return static_cast<SymbolId>(read_short());
+        };
+        // Must be called after any change to the frame stack.
+        auto load_frame = [&](){
+            frame = &frames.back();
+            ip = frame->ip;
+            chunk = &frame->closure->function->get_chunk();
+        };
+
+        while (true){
+            switch (static_cast<OpCode>(read_byte())){
+                case OpCode::CONSTANT:
+                    push(chunk->get_constant(read_short()));
+                    break;
+                case OpCode::NIL:
+                    push(Value::nil());
+                    break;
+                case OpCode::TRUE:
+                    push(true);
+                    break;
+                case OpCode::FALSE:
+                    push(false);
+                    break;
+                case OpCode::POP:
+                    stack.pop_back();
+                    break;
+                case OpCode::GET_LOCAL:
+                    push(stack[frame->base + read_byte()]);
+                    break;
+                case OpCode::SET_LOCAL:
+                    stack[frame->base + read_byte()] = peek(0);
+                    break;
+                case OpCode::GET_GLOBAL:{
+                    uint16_t id = read_short();
+                    if (!defined_globals[id]){
+                        throw runtime_error("Attempting to access nonexistent variable '" + global_table.get_name(id) + "'");
+                    }
+                    push(globals[id]);
+                    break;
+                }
+                case OpCode::DEFINE_GLOBAL:{
+                    uint16_t id = read_short();
+                    globals[id] = pop();
+                    defined_globals[id] = true;
+                    break;
+                }
+                case OpCode::SET_GLOBAL:{
+                    uint16_t id = read_short();
+                    if (!defined_globals[id]){
+                        throw runtime_error("Undefined variable '" + global_table.get_name(id) + "'");
+                    }
+                    globals[id] = peek(0);
+                    break;
+                }
+                case OpCode::GET_UPVALUE:{
+                    VmUpvalue& upvalue = *frame->closure->upvalues[read_byte()];
+                    push(upvalue.is_open ? stack[upvalue.slot] : upvalue.closed);
+                    break;
+                }
+                case OpCode::SET_UPVALUE:{
+                    VmUpvalue& upvalue = *frame->closure->upvalues[read_byte()];
+                    (upvalue.is_open ? stack[upvalue.slot] : upvalue.closed) = peek(0);
+                    break;
+                }
+                case OpCode::GET_PROPERTY:{
+                    if (!is_cls_inst(peek(0))){
+                        throw runtime_error("Can only access attributes from class instances.");
+                    }
+                    InstancePtr inst = peek(0).as_instance();
+                    peek(0) = inst->get_attr(read_symbol());
+                    break;
+                }
+                case OpCode::SET_PROPERTY:{
+                    if (!is_cls_inst(peek(1))){
+                        throw runtime_error("Cannot access fields from non-instance values.");
+                    }
+                    Value value = pop();
+                    peek(0).as_instance()->set_attr(read_symbol(), value);
+                    peek(0) = std::move(value);
+                    break;
+                }
+                case OpCode::GET_SUPER:{
+                    SymbolId name = read_symbol();
+                    auto super_cls = static_obj_cast<LoxClass>(pop().as_callable());
+                    CallablePtr method = super_cls->find_meth(name);
+                    if (method == nullptr){
+                        throw runtime_error("Undefined property '" + lox::symbols::get_name(name) + "'.");
+                    }
+                    peek(0) = method->bind(peek(0).as_instance());
+                    break;
+                }
+                case OpCode::GET_METHOD:{
+                    if (!is_cls_inst(peek(0))){
+                        throw runtime_error("Can only access attributes from class instances.");
+                    }
+                    SymbolId name = read_symbol();
+                    InstancePtr inst = peek(0).as_instance();
+                    CallablePtr method = inst->find_method(name);
+                    if (method != nullptr){
+                        push(method);
+                        break;
+                    }
+                    // A field holding a callable, called like any other value.
+                    peek(0) = inst->get_attr(name);
+                    if (!is_callable(peek(0))){
+                        throw runtime_error("Given object is not callable.");
+                    }
+                    push(Value::nil());
+                    break;
+                }
+                case OpCode::GET_SUPER_METHOD:{
+                    SymbolId name = read_symbol();
+                    auto super_cls = static_obj_cast<LoxClass>(pop().as_callable());
+                    CallablePtr method = super_cls->find_meth(name);
+                    if (method == nullptr){
+                        throw runtime_error("Undefined property '" + lox::symbols::get_name(name) + "'.");
+                    }
+                    push(method);
+                    break;
+                }
+                case OpCode::EQUAL:{
+                    Value right = pop();
+                    peek(0) = values_equal(peek(0), right);
+                    break;
+                }
+                case OpCode::NOT_EQUAL:{
+                    Value right = pop();
+                    peek(0) = !values_equal(peek(0), right);
+                    break;
+                }
+                case OpCode::GREATER:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() > right.as_number();
+                    break;
+                }
+                case OpCode::GREATER_EQUAL:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() >= right.as_number();
+                    break;
+                }
+                case OpCode::LESS:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() < right.as_number();
+                    break;
+                }
+                case OpCode::LESS_EQUAL:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() <= right.as_number();
+                    break;
+                }
+                case OpCode::ADD:{
+                    Value right = pop();
+                    Value& left = peek(0);
+                    if (is_number(left) && is_number(right)){
+                        left = left.as_number() + right.as_number();
+                    }
+                    else if (is_string(left) && is_string(right)){
+                        left = Value::concat_strings(left, right);
+                    }
+                    else{
+                        throw parse_error(70, "Unsupported operation.");
+                    }
+                    break;
+                }
+                case OpCode::SUBTRACT:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() - right.as_number();
+                    break;
+                }
+                case OpCode::MULTIPLY:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() * right.as_number();
+                    break;
+                }
+                case OpCode::DIVIDE:{
+                    Value right = pop();
+                    check_number_operands(peek(0), right);
+                    peek(0) = peek(0).as_number() / right.as_number();
+                    break;
+                }
+                case OpCode::NOT:
+                    peek(0) = !is_truthy(peek(0));
+                    break;
+                case OpCode::NEGATE:
+                    if (!is_number(peek(0))){
+                        throw parse_error(70, "Invalid operand for unary expression.");
+                    }
+                    peek(0) = -peek(0).as_number();
+                    break;
+                case OpCode::PRINT:
+                    print_value(pop());
+                    break;
+                case OpCode::JUMP:{
+                    uint16_t offset = read_short();
+                    ip += offset;
+                    break;
+                }
+                case OpCode::JUMP_IF_FALSE:{
+                    uint16_t offset = read_short();
+                    if (!is_truthy(peek(0))){
+                        ip += offset;
+                    }
+                    break;
+                }
+                case OpCode::LOOP:{
+                    uint16_t offset = read_short();
+                    ip -= offset;
+                    Heap::get().collect_if_needed();
+                    break;
+                }
+                case OpCode::CALL:{
+                    ubyte arg_count = read_byte();
+                    frame->ip = ip;
+                    Heap::get().collect_if_needed();
+                    call_value(arg_count);
+                    load_frame();
+                    break;
+                }
+                case OpCode::INVOKE:{
+                    ubyte arg_count = read_byte();
+                    frame->ip = ip;
+                    Heap::get().collect_if_needed();
+                    // Drop the method from under the arguments, leaving the receiver in the callee slot.
+                    // Methods are kept alive by the class of the receiver.
+                    auto method_slot = stack.end() - arg_count - 1;
+                    Value method = std::move(*method_slot);
+                    stack.erase(method_slot);
+                    if (method.is_nil()){
+                        call_value(arg_count);
+                    }
+                    else{
+                        call_closure(static_cast<VmClosure*>(method.as_callable().get()), arg_count);
+                    }
+                    load_frame();
+                    break;
+                }
+                case OpCode::CLOSURE:{
+                    auto closure = make_obj<VmClosure>(chunk->get_function(read_short()));
+                    for (ubyte i = 0; i < closure->function->get_upvalue_count(); ++i){
+                        bool is_local = read_byte() == 1;
+                        ubyte index = read_byte();
+                        closure->upvalues.push_back(
+                            is_local ? capture_upvalue(frame->base + index) : frame->closure->upvalues[index]
+                        );
+                    }
+                    push(closure);
+                    break;
+                }
+                case OpCode::CLOSE_UPVALUE:
+                    close_upvalues(stack.size() - 1);
+                    stack.pop_back();
+                    break;
+                case OpCode::RETURN:{
+                    Value result = pop();
+                    close_upvalues(frame->base);
+                    size_t base = frame->base;
+                    frames.pop_back();
+                    stack.resize(base);
+                    if (frames.empty()){
+                        return;
+                    }
+                    push(std::move(result));
+                    load_frame();
+                    break;
+                }
+                case OpCode::CLASS:{
+                    string name = read_name();
+                    ubyte meth_count = read_byte();
+                    bool has_supercls = read_byte() == 1;
+
+                    ClassPtr supercls = nullptr;
+                    if (has_supercls){
+                        Value superclass = pop();
+                        if (!is_callable(superclass) || superclass.as_callable()->get_kind() != CallableKind::CLASS){
+                            throw runtime_error("Superclass must be a class.");
+                        }
+                        supercls = static_obj_cast<LoxClass>(superclass.as_callable());
+                    }
+
+                    MethodMap meth_map;
+                    meth_map.reserve(meth_count);
+                    for (auto it = stack.end() - meth_count; it != stack.end(); ++it){
+                        auto meth = static_obj_cast<VmClosure>(it->as_callable());
+                        meth_map.insert({meth->function->get_name(), meth});
+                    }
+                    stack.resize(stack.size() - meth_count);
+                    push(make_obj<LoxClass>(name, supercls, meth_map));
+                    break;
+                }
+            }
+        }
+    }
+
+    void VM::interpret(const vector<StmtPtr>& statements){
+        Compiler compiler(global_table);
+        auto closure = make_obj<VmClosure>(compiler.compile_script(statements));
+        globals.resize(global_table.size());
+        defined_globals.resize(global_table.size(), false);
+
+        push(closure);
+        call_closure(closure.get(), 0);
+        run();
+    }
+    // endregion
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include "ast.hpp"
+#include "callable.hpp"
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "exceptions.hpp"
+#include "gc.hpp"
+#include "instance.hpp"
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace lox::vm{
+    namespace builtins = lox::callable::builtins;
+    using lox::callable::AbstractLoxCallable;
+    using lox::callable::CallableKind;
+    using lox::callable::CallablePtr;
+    using lox::callable::InstancePtr;
+    using lox::callable::LoxClass;
+    using lox::callable::MethodMap;
+    using lox::env::Environment;
+    using lox::gc::Heap;
+    using lox::gc::RootSource;
+    using lox::gc::Tracer;
+    using lox::inst::ClassPtr;
+    using lox::interpreter::Interpreter;
+    using lox::symbols::SymbolId;
+    using lox::value::make_obj;
+    using lox::value::Obj;
+    using lox::value::ObjType;
+    using lox::value::Ref;
+    using lox::value::static_obj_cast;
+
+    using std::make_shared;
+    using std::runtime_error;
+    using std::shared_ptr;
+    using std::string;
+    using std::vector;
+
+    // A variable captured by a closure.
+    // It refers to a stack slot while that slot is alive (open), then owns a copy of the value (closed).
+    class VmUpvalue: public Obj{
+        size_t slot;
+        Value closed;
+        bool is_open = true;
+
+        friend class VM;
+
+        public:
+            explicit VmUpvalue(size_t slot): Obj(ObjType::UPVALUE), slot(slot){}
+
+            void trace(Tracer& tracer) const final{
+                tracer.visit(closed);
+            }
+
+            void clear_refs() final{
+                closed = Value::nil();
+            }
+    };
+
+    using UpvaluePtr = Ref<VmUpvalue>;
+
+    class VmClosure: public AbstractLoxCallable{
+        shared_ptr<VmFunction> function;
+        vector<UpvaluePtr> upvalues;
+
+        friend class VM;
+
+        public:
+            explicit VmClosure(const shared_ptr<VmFunction>& function);
+
+            [[nodiscard]] string to_string() const final{
+                return "<fn " + function->get_name() + ">";
+            }
+
+            [[nodiscard]] ubyte arity() const final{
+                return function->get_arity();
+            }
+
+            [[nodiscard]] CallablePtr bind(const InstancePtr& inst) final;
+
+            [[nodiscard]] Value call(Interpreter& interpreter, const vector<Value>& args) final;
+
+            void trace(Tracer& tracer) const final;
+
+            void clear_refs() final;
+    };
+
+    // A method retrieved from an instance, remembering the instance it was accessed from.
+    class VmBoundMethod: public AbstractLoxCallable{
+        InstancePtr receiver;
+        Ref<VmClosure> method;
+
+        friend class VM;
+
+        public:
+            VmBoundMethod(const InstancePtr& receiver, const Ref<VmClosure>& method)
+            : AbstractLoxCallable(CallableKind::VM_BOUND_METHOD), receiver(receiver), method(method){}
+
+            [[nodiscard]] string to_string() const final{
+                return method->to_string();
+            }
+
+            [[nodiscard]] ubyte arity() const final{
+                return method->arity();
+            }
+
+            [[nodiscard]] Value call(Interpreter& interpreter, const vector<Value>& args) final;
+
+            void trace(Tracer& tracer) const final{
+                tracer.visit(receiver);
+                tracer.visit(method);
+            }
+
+            void clear_refs() final{
+                receiver = nullptr;
+                method = nullptr;
+            }
+    };
+
+    // Bytecode interpreter. Runs programs compiled by lox::vm::Compiler on a value stack.
+    class VM: public RootSource{
+        struct CallFrame{
+            // Kept alive by the callee slot at the bottom of the frame (either the closure itself or the receiver).
+            VmClosure* closure;
+            const ubyte* ip;
+            size_t base;  // Index of the frame's slot zero in the value stack.
+        };
+
+        static constexpr size_t FRAMES_MAX = 4096;
+
+        vector<Value> stack;
+        vector<CallFrame> frames;
+        vector<UpvaluePtr> open_upvalues;  // Sorted by stack slot.
+        GlobalTable global_table;
+        vector<Value> globals;
+        vector<bool> defined_globals;
+
+        void define_builtin(const string& name, const CallablePtr& func);
+        void define_builtins();
+
+        void push(Value value){
+            stack.push_back(std::move(value));
+        }
+
+        Value pop(){
+            Value ret = std::move(stack.back());
+            stack.pop_back();
+            return ret;
+        }
+
+        [[nodiscard]] Value& peek(size_t distance){
+            return stack[stack.size() - 1 - distance];
+        }
+
+        void call_closure(VmClosure* closure, ubyte arg_count);
+        void call_value(ubyte arg_count);
+        UpvaluePtr capture_upvalue(size_t slot);
+        void close_upvalues(size_t last_slot);
+
+        void run();
+
+        public:
+            VM();
+            ~VM() override;
+
+            void trace_roots(Tracer& tracer) const final;
+
+            // Compiles and runs the given resolved statements.
+            void interpret(const vector<StmtPtr>& statements);
+    };
+}
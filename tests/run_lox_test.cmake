@@ -0,0 +1,45 @@
+# Runs a Lox script and compares what it does with the expectations written in its comments:
+# - "// expect: <text>" for every line the script prints, in order,
+# - "// expect runtime error: <message>" if the script stops with a runtime error.
+# Usage: cmake -DINTERPRETER=<path> [-DLOX_COMMAND=run|evaluate|optimize] [-DENGINE=tree|vm] [-DOPTIONS=<options>]
+#        -DSCRIPT=<path> -P run_lox_test.cmake
+# The engine and the other options only apply to the run command, which is the default.
+
+file(STRINGS "${SCRIPT}" script_lines)
+set(expected_output "")
+set(expected_error "")
+set(expected_code 0)
+foreach(line IN LISTS script_lines)
+    if(line MATCHES "// expect: (.*)$")
+        string(APPEND expected_output "${CMAKE_MATCH_1}\n")
+    elseif(line MATCHES "// expect runtime error: (.*)$")
+        set(expected_error "${CMAKE_MATCH_1}\n")
+        set(expected_code 70)
+    endif()
+endforeach()
+
+if(NOT DEFINED LOX_COMMAND)
+    set(LOX_COMMAND run)
+endif()
+if(LOX_COMMAND STREQUAL "run")
+    set(options "--engine=${ENGINE}" ${OPTIONS})
+else()
+    set(options "")
+endif()
+
+execute_process(
+    COMMAND "${INTERPRETER}" ${LOX_COMMAND} ${options} "${SCRIPT}"
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE error
+    RESULT_VARIABLE code
+)
+
+if(NOT output STREQUAL expected_output)
+    message(FATAL_ERROR "Expected output:\n${expected_output}\nGot:\n${output}")
+endif()
+if(NOT error STREQUAL expected_error)
+    message(FATAL_ERROR "Expected errors:\n${expected_error}\nGot:\n${error}")
+endif()
+if(NOT code STREQUAL expected_code)
+    message(FATAL_ERROR "Expected exit code ${expected_code}, got ${code}")
+endif()